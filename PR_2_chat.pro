@@ -1,23 +1,53 @@
-QT       += core gui network sql
+QT       += core gui network sql concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++17
 
+# Общие ключи билетов сессий TLS для всех подключений к встроенному серверу:
+# без OpenSSL сервер не возобновляет сессии
+packagesExist(openssl) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += openssl
+    DEFINES += CHAT_SHARED_TICKET_KEYS
+}
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    commandlineoptions.cpp \
     databasemanager.cpp \
+    historysync.cpp \
     main.cpp \
     mainwindow.cpp \
-    networkmanager.cpp
+    networkmanager.cpp \
+    partitiontool.cpp \
+    readconnectionpool.cpp \
+    relaynode.cpp \
+    replaytool.cpp \
+    timerwheel.cpp \
+    tlsbenchmark.cpp \
+    tracer.cpp \
+    trafficcapture.cpp \
+    wireprotocol.cpp
 
 HEADERS += \
+    commandlineoptions.h \
     databasemanager.h \
+    historysync.h \
     mainwindow.h \
-    networkmanager.h
+    networkmanager.h \
+    partitiontool.h \
+    readconnectionpool.h \
+    relaynode.h \
+    replaytool.h \
+    timerwheel.h \
+    tlsbenchmark.h \
+    tracer.h \
+    trafficcapture.h \
+    wireprotocol.h
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,35 @@
+#include "commandlineoptions.h"
+
+/**
+ * Возвращает значение аргумента командной строки
+ *
+ * @param arguments Аргументы командной строки
+ * @param name Имя аргумента, например "--speed"
+ * @param defaultValue Значение, если аргумент не указан или за ним нет значения
+ * @return Значение аргумента
+ */
+QString argumentValue(const QStringList &arguments, const QString &name, const QString &defaultValue)
+{
+    const int index = arguments.indexOf(name);
+    if (index < 0 || index + 1 >= arguments.size()) {
+        return defaultValue;
+    }
+    return arguments.at(index + 1);
+}
+
+/**
+ * Возвращает значения аргумента, который может повторяться, например "--peer"
+ *
+ * @param arguments Аргументы командной строки
+ * @param name Имя аргумента
+ * @return Значения в порядке следования; пустой список, если аргумента нет
+ */
+QStringList argumentValues(const QStringList &arguments, const QString &name)
+{
+    QStringList values;
+    for (int index = arguments.indexOf(name); index >= 0 && index + 1 < arguments.size();
+         index = arguments.indexOf(name, index + 2)) {
+        values.append(arguments.at(index + 1));
+    }
+    return values;
+}
@@ -0,0 +1,16 @@
+#ifndef COMMANDLINEOPTIONS_H
+#define COMMANDLINEOPTIONS_H
+
+#include <QString>
+#include <QStringList>
+
+/*
+ * Разбор аргументов командной строки для режимов без окна
+ */
+
+// Значение аргумента name (следующий за ним элемент) или defaultValue, если аргумента нет
+QString argumentValue(const QStringList &arguments, const QString &name, const QString &defaultValue = QString());
+// Значения всех повторов аргумента name в порядке их следования
+QStringList argumentValues(const QStringList &arguments, const QString &name);
+
+#endif // COMMANDLINEOPTIONS_H
@@ -1,14 +1,198 @@
 #include "databasemanager.h"
+#include "tracer.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QMap>
+#include <QtConcurrent>
+#include <QtEndian>
+#include <algorithm>
+
+namespace {
+
+// Имена подключений к разделам для записи новых сообщений и для импорта
+const char WriteConnectionName[] = "partition_writer";
+const char ImportConnectionName[] = "partition_importer";
+
+// Верхняя граница для строкового сравнения: больше любой метки времени в формате ISO
+const char UnboundedUpperKey[] = "~";
+
+// Нижняя граница для строкового сравнения: недействительное время означает отсутствие ограничения
+// Пустая строка должна быть не null, иначе QSQLITE привяжет ее как NULL и условие не выполнится
+QString lowerBoundKey(const QDateTime &from)
+{
+    return from.isValid() ? from.toString(Qt::ISODate) : QStringLiteral("");
+}
+
+// Условие выборки по интервалу меток времени
+const char RangeCondition[] = "timestamp >= ? AND timestamp < ?";
+// Условие поиска по тексту сообщения
+const char SearchCondition[] = "message LIKE ? ESCAPE '\\'";
+
+// Вставка сообщения; повтор уже известного сообщения пропускается по уникальному индексу
+const char InsertMessage[] =
+    "INSERT OR IGNORE INTO messages (timestamp, message, direction, origin_id, sequence, origin_time, row_hash) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?)";
+
+// Последний момент, представимый меткой времени ISO с четырехзначным годом
+const qint64 MaxIsoTimeMs = Q_INT64_C(253402300799999);
+
+// Раздел выбирается по местному времени записи, которое позже времени отправки
+// на задержку доставки; при выборе файлов по времени отправки интервал расширяется на сутки
+const qint64 OriginTimeMarginMs = 24 * 60 * 60 * 1000;
+
+// Хеш идентификатора сообщения: первые 4 байта MD5 от узла и номера
+// 32 бита, чтобы сумма хешей интервала в SQLite не переполнялась
+quint32 originHash(const WireProtocol::MessageOrigin &origin)
+{
+    QByteArray key(2 * sizeof(quint64), Qt::Uninitialized);
+    qToBigEndian<quint64>(origin.nodeId, key.data());
+    qToBigEndian<quint64>(origin.sequence, key.data() + sizeof(quint64));
+    const QByteArray digest = QCryptographicHash::hash(key, QCryptographicHash::Md5);
+    return qFromBigEndian<quint32>(digest.constData());
+}
+
+// Привязывает к запросу InsertMessage сообщение с происхождением; без него столбцы остаются NULL
+void bindMessage(QSqlQuery &query, const QString &timestamp, const QString &message, bool incoming,
+                 const WireProtocol::MessageOrigin &origin)
+{
+    query.addBindValue(timestamp);
+    query.addBindValue(message);
+    query.addBindValue(incoming ? "incoming" : "outgoing");
+    if (origin.isValid()) {
+        // Идентификаторы хранятся как знаковые 64-битные числа SQLite
+        query.addBindValue(qint64(origin.nodeId));
+        query.addBindValue(qint64(origin.sequence));
+        query.addBindValue(origin.timeMs);
+        query.addBindValue(qint64(originHash(origin)));
+    } else {
+        for (int i = 0; i < 4; ++i) {
+            query.addBindValue(QVariant());
+        }
+    }
+}
+
+// Добавляет в таблицу сообщений столбцы происхождения, если файл создан до их появления,
+// и индексы для сверки истории
+bool addOriginColumns(QSqlDatabase &database)
+{
+    QSqlQuery query(database);
+    if (!query.exec("PRAGMA table_info(messages)")) {
+        qDebug() << "Ошибка чтения схемы:" << query.lastError().text();
+        return false;
+    }
+    QStringList columns;
+    while (query.next()) {
+        columns.append(query.value(1).toString());
+    }
+
+    const QStringList originColumns = {"origin_id", "sequence", "origin_time", "row_hash"};
+    for (const QString &column : originColumns) {
+        if (!columns.contains(column) && !query.exec("ALTER TABLE messages ADD COLUMN " + column + " INTEGER")) {
+            qDebug() << "Ошибка обновления схемы:" << query.lastError().text();
+            return false;
+        }
+    }
+
+    // Строки без происхождения (NULL) уникальным индексом не ограничиваются
+    const bool success =
+        query.exec("CREATE UNIQUE INDEX IF NOT EXISTS messages_origin ON messages (origin_id, sequence)")
+        && query.exec("CREATE INDEX IF NOT EXISTS messages_origin_time ON messages (origin_time)");
+    if (!success) {
+        qDebug() << "Ошибка обновления схемы:" << query.lastError().text();
+    }
+    return success;
+}
+
+// Выполняет read для каждого файла параллельно в пуле pool и объединяет
+// результаты функцией combine в порядке файлов
+template <typename Result, typename Read, typename Combine>
+Result fanOut(QThreadPool *pool, const QStringList &paths, Read read, Combine combine)
+{
+    QList<QFuture<Result>> futures;
+    for (const QString &path : paths) {
+        futures.append(QtConcurrent::run(pool, [read, path]() {
+            return read(path);
+        }));
+    }
+
+    Result result;
+    for (QFuture<Result> &future : futures) {
+        combine(result, future.result());
+    }
+    return result;
+}
+
+// Префикс меток времени раздела: "yyyy-MM" для месяца или "yyyy-MM-dd" для дня
+QString partitionPrefix(const QString &key)
+{
+    QString prefix = key.left(4) + "-" + key.mid(4, 2);
+    if (key.size() == 8) {
+        prefix += "-" + key.mid(6, 2);
+    }
+    return prefix;
+}
+
+// Создает таблицу сообщений и индекс по времени в файле раздела
+bool createPartitionTable(QSqlDatabase &database)
+{
+    QSqlQuery query(database);
+    bool success = query.exec(
+        "CREATE TABLE IF NOT EXISTS messages ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "timestamp DATETIME,"
+        "message TEXT,"
+        "direction TEXT,"
+        "origin_id INTEGER,"
+        "sequence INTEGER,"
+        "origin_time INTEGER,"
+        "row_hash INTEGER"
+        ")"
+    ) && query.exec("CREATE INDEX IF NOT EXISTS messages_timestamp ON messages (timestamp)");
+
+    if (!success) {
+        qDebug() << "Ошибка создания раздела:" << query.lastError().text();
+        return false;
+    }
+    return addOriginColumns(database);
+}
+
+// Включает журнал упреждающей записи: читатели видят последнее зафиксированное
+// состояние и не ждут писателя, а писатель не ждет читателей
+void enableWriteAheadLog(QSqlDatabase &database)
+{
+    QSqlQuery query(database);
+    if (!query.exec("PRAGMA journal_mode=WAL") || !query.exec("PRAGMA synchronous=NORMAL")) {
+        qDebug() << "Ошибка включения WAL:" << query.lastError().text();
+    }
+}
+
+} // namespace
 
 // Конструктор класса
 DatabaseManager::DatabaseManager(QObject *parent)
     : QObject(parent)
+    , m_partitionScheme(PartitionByMonth)
 {
+    // Потоки не завершаются по простою, иначе их подключения для чтения
+    // остались бы зарегистрированными за уже несуществующим потоком
+    m_queryPool.setExpiryTimeout(-1);
+    m_mergePool.setExpiryTimeout(-1);
+    
+    m_writer.connectionName = WriteConnectionName;
+    m_importer.connectionName = ImportConnectionName;
 }
 
 // Деструктор класса: закрывает соединение с базой данных
 DatabaseManager::~DatabaseManager()
 {
+    // Дожидаемся завершения запросов, еще выполняющихся в пуле
+    releaseReaders();
+    closeWritePartition(m_writer);
+    closeWritePartition(m_importer);
+
     if (m_database.isOpen()) {
         m_database.close();
     }
@@ -17,6 +201,9 @@ DatabaseManager::~DatabaseManager()
 // Открывает соединение с базой данных SQLite по указанному пути
 bool DatabaseManager::openDatabase(const QString &dbPath)
 {
+    // Разделы будут храниться рядом с основной базой
+    m_dbPath = dbPath;
+    
     // Создаем подключение к SQLite
     m_database = QSqlDatabase::addDatabase("QSQLITE");
     m_database.setDatabaseName(dbPath);
@@ -26,9 +213,19 @@ bool DatabaseManager::openDatabase(const QString &dbPath)
         qDebug() << "Ошибка открытия базы данных:" << m_database.lastError().text();
         return false;
     }
+    enableWriteAheadLog(m_database);
     
     // Создаем необходимые таблицы
-    return createTables();
+    if (!createTables()) {
+        return false;
+    }
+
+    // Узлы прошлых запусков этого экземпляра
+    QSqlQuery query("SELECT node_id FROM local_nodes");
+    while (query.next()) {
+        m_localNodes.insert(quint64(query.value(0).toLongLong()));
+    }
+    return true;
 }
 
 // Создает нужные таблицы в базе данных, если они еще не существуют
@@ -45,23 +242,111 @@ bool DatabaseManager::createTables()
         ")"
     );
     
+    // Идентификаторы узлов, которыми этот экземпляр подписывал свои сообщения
+    if (success) {
+        success = query.exec("CREATE TABLE IF NOT EXISTS local_nodes (node_id INTEGER PRIMARY KEY)");
+    }
+    
     if (!success) {
         qDebug() << "Ошибка создания таблиц:" << query.lastError().text();
         return false;
     }
     
+    return addOriginColumns(m_database);
+}
+
+// Запоминает узел этого экземпляра; идентификатор узла случаен для каждого запуска,
+// поэтому хранятся все прошлые идентификаторы
+void DatabaseManager::registerLocalNode(quint64 nodeId)
+{
+    m_localNodes.insert(nodeId);
+    
+    QSqlQuery query(m_database);
+    query.prepare("INSERT OR IGNORE INTO local_nodes (node_id) VALUES (?)");
+    query.addBindValue(qint64(nodeId));
+    if (!query.exec()) {
+        qDebug() << "Ошибка записи узла:" << query.lastError().text();
+    }
+}
+
+// Задает схему разбиения; действует для записей, сделанных после вызова
+void DatabaseManager::setPartitionScheme(PartitionScheme scheme)
+{
+    m_partitionScheme = scheme;
+}
+
+// Возвращает ключ раздела: "yyyyMM" при разбиении по месяцам или "yyyyMMdd" по дням
+QString DatabaseManager::partitionKey(const QDateTime &time) const
+{
+    return time.toString(m_partitionScheme == PartitionByDay ? "yyyyMMdd" : "yyyyMM");
+}
+
+// Возвращает путь к файлу раздела: chat.db -> chat_202610.db
+QString DatabaseManager::partitionPath(const QString &key) const
+{
+    QFileInfo info(m_dbPath);
+    QString fileName = info.completeBaseName() + "_" + key;
+    if (!info.suffix().isEmpty()) {
+        fileName += "." + info.suffix();
+    }
+    return info.dir().filePath(fileName);
+}
+
+// Открывает файл раздела для записи в отдельном подключении
+bool DatabaseManager::openWritePartition(PartitionWriter &writer, const QString &key)
+{
+    closeWritePartition(writer);
+    
+    writer.database = QSqlDatabase::addDatabase("QSQLITE", writer.connectionName);
+    writer.database.setDatabaseName(partitionPath(key));
+    
+    if (!writer.database.open()) {
+        qDebug() << "Ошибка открытия раздела:" << writer.database.lastError().text();
+        closeWritePartition(writer);
+        return false;
+    }
+    
+    enableWriteAheadLog(writer.database);
+    if (!createPartitionTable(writer.database)) {
+        closeWritePartition(writer);
+        return false;
+    }
+    
+    writer.key = key;
     return true;
 }
 
+// Закрывает подключение к разделу для записи, если оно открыто
+void DatabaseManager::closeWritePartition(PartitionWriter &writer)
+{
+    if (!writer.database.isValid()) {
+        return;
+    }
+    
+    writer.database.close();
+    // Подключение можно удалить только после освобождения всех его копий
+    writer.database = QSqlDatabase();
+    QSqlDatabase::removeDatabase(writer.connectionName);
+    writer.key.clear();
+}
+
 // Записывает сообщение в журнал с указанием входящее оно или исходящее
-void DatabaseManager::logMessage(const QString &message, bool incoming)
+// Запись всегда идет в раздел текущего дня или месяца
+void DatabaseManager::logMessage(const QString &message, bool incoming, const WireProtocol::MessageOrigin &origin)
 {
-    QSqlQuery query;
+    TraceSpan span("db.logMessage");
+    
+    // При смене дня или месяца переключаемся на новый раздел
+    const QDateTime now = QDateTime::currentDateTime();
+    const QString key = partitionKey(now);
+    if (key != m_writer.key && !openWritePartition(m_writer, key)) {
+        return;
+    }
+    
+    QSqlQuery query(m_writer.database);
     // Подготавливаем SQL-запрос для вставки записи
-    query.prepare("INSERT INTO messages (timestamp, message, direction) VALUES (?, ?, ?)");
-    query.addBindValue(QDateTime::currentDateTime().toString(Qt::ISODate));
-    query.addBindValue(message);
-    query.addBindValue(incoming ? "incoming" : "outgoing");
+    query.prepare(InsertMessage);
+    bindMessage(query, now.toString(Qt::ISODate), message, incoming, origin);
     
     // Выполняем запрос
     if (!query.exec()) {
@@ -69,13 +354,221 @@ void DatabaseManager::logMessage(const QString &message, bool incoming)
     }
 }
 
+// Добавляет сообщения, полученные при сверке истории с другим экземпляром
+// Метка времени строится из времени отправки, направление - по узлу-источнику,
+// поэтому копии одного сообщения у разных экземпляров совпадают по смыслу
+// Каждое сообщение попадает в раздел своей метки времени, а сообщения
+// одного раздела вставляются одной транзакцией
+int DatabaseManager::importMessages(const SyncRecordList &records)
+{
+    QMap<QString, SyncRecordList> byPartition;
+    for (const SyncRecord &record : records) {
+        if (record.origin.isValid()) {
+            byPartition[partitionKey(QDateTime::fromMSecsSinceEpoch(record.origin.timeMs))].append(record);
+        }
+    }
+    
+    int imported = 0;
+    for (auto it = byPartition.cbegin(); it != byPartition.cend(); ++it) {
+        // В текущий раздел пишем через подключение журналирования, в исторические -
+        // через подключение импорта, которое остается открытым для следующих пачек
+        PartitionWriter &writer = it.key() == m_writer.key ? m_writer : m_importer;
+        if (it.key() != writer.key && !openWritePartition(writer, it.key())) {
+            continue;
+        }
+        
+        writer.database.transaction();
+        QSqlQuery query(writer.database);
+        query.prepare(InsertMessage);
+        for (const SyncRecord &record : it.value()) {
+            const QString timestamp = QDateTime::fromMSecsSinceEpoch(record.origin.timeMs).toString(Qt::ISODate);
+            const bool incoming = !m_localNodes.contains(record.origin.nodeId);
+            bindMessage(query, timestamp, record.message, incoming, record.origin);
+            if (!query.exec()) {
+                qDebug() << "Ошибка импорта сообщения:" << query.lastError().text();
+            } else if (query.numRowsAffected() > 0) {
+                ++imported;
+            }
+        }
+        writer.database.commit();
+    }
+    
+    return imported;
+}
+
 // Получает все сообщения из базы данных и возвращает их в структурированном виде
-QList<QPair<QString, QPair<QString, bool>>> DatabaseManager::getMessages()
+DatabaseManager::MessageList DatabaseManager::getMessages()
+{
+    return getMessages(QDateTime(), QDateTime());
+}
+
+// Получает сообщения за интервал времени [from, to)
+// Каждый подходящий раздел (и основная база со старой историей) читается
+// в пуле потоков через собственное подключение, затем упорядоченные
+// результаты сливаются по времени
+DatabaseManager::MessageList DatabaseManager::getMessages(const QDateTime &from, const QDateTime &to)
+{
+    const QString fromKey = lowerBoundKey(from);
+    const QString toKey = to.isValid() ? to.toString(Qt::ISODate) : QString(UnboundedUpperKey);
+    return queryRange(fromKey, toKey);
+}
+
+// Читает сообщения строкового интервала из основной базы и подходящих разделов
+DatabaseManager::MessageList DatabaseManager::queryRange(const QString &fromKey, const QString &toKey)
+{
+    return collectMessages(&m_queryPool, &m_readers, queryPaths(fromKey, toKey),
+                           RangeCondition, {fromKey, toKey});
+}
+
+// Получает сообщения за интервал без ожидания: файлы читаются в пуле потоков,
+// а результат сливается в отдельном потоке, поэтому вызывающий поток не блокируется
+QFuture<DatabaseManager::MessageList> DatabaseManager::getMessagesAsync(const QDateTime &from, const QDateTime &to)
+{
+    const QString fromKey = lowerBoundKey(from);
+    const QString toKey = to.isValid() ? to.toString(Qt::ISODate) : QString(UnboundedUpperKey);
+    return startQuery(queryPaths(fromKey, toKey), RangeCondition, {fromKey, toKey});
+}
+
+// Ищет сообщения по подстроке во всей истории без ожидания
+QFuture<DatabaseManager::MessageList> DatabaseManager::searchMessagesAsync(const QString &text)
+{
+    // Символы шаблона LIKE в тексте ищутся буквально
+    QString pattern = text;
+    pattern.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+    return startQuery(queryPaths(QString(), UnboundedUpperKey), SearchCondition, {QString("%" + pattern + "%")});
+}
+
+// Возвращает основную базу и разделы, пересекающиеся с интервалом
+QStringList DatabaseManager::queryPaths(const QString &fromKey, const QString &toKey) const
+{
+    // Основная база хранит историю, записанную до разбиения на разделы
+    QStringList paths;
+    if (!m_dbPath.isEmpty()) {
+        paths.append(m_dbPath);
+    }
+    
+    // Пропускаем разделы, целиком лежащие вне интервала
+    for (const QString &key : partitions()) {
+        const QString prefix = partitionPrefix(key);
+        if (prefix + UnboundedUpperKey > fromKey && prefix < toKey) {
+            paths.append(partitionPath(key));
+        }
+    }
+    return paths;
+}
+
+// Расширяет интервал времени отправки на OriginTimeMarginMs и переводит его
+// в строковый интервал местных меток времени
+QStringList DatabaseManager::originPaths(qint64 fromMs, qint64 toMs) const
+{
+    const qint64 lower = fromMs - OriginTimeMarginMs;
+    const qint64 upper = toMs + OriginTimeMarginMs;
+    const QString fromKey = lower > 0 ? QDateTime::fromMSecsSinceEpoch(lower).toString(Qt::ISODate)
+                                      : QStringLiteral("");
+    const QString toKey = upper < MaxIsoTimeMs ? QDateTime::fromMSecsSinceEpoch(upper).toString(Qt::ISODate)
+                                               : QString(UnboundedUpperKey);
+    return queryPaths(fromKey, toKey);
+}
+
+// Считает сводки интервалов без ожидания: агрегаты строятся запросом SQL
+// по каждому файлу в m_queryPool и складываются в m_mergePool
+QFuture<DatabaseManager::BucketDigestMap> DatabaseManager::bucketDigestsAsync(qint64 fromMs, qint64 toMs, int shift)
+{
+    QThreadPool *pool = &m_queryPool;
+    ReadConnectionPool *readers = &m_readers;
+    const QStringList paths = originPaths(fromMs, toMs);
+    return QtConcurrent::run(&m_mergePool, [pool, readers, paths, fromMs, toMs, shift]() {
+        return fanOut<BucketDigestMap>(pool, paths, [readers, fromMs, toMs, shift](const QString &path) {
+            return queryBucketDigests(readers, path, fromMs, toMs, shift);
+        }, [](BucketDigestMap &digests, const BucketDigestMap &part) {
+            for (auto it = part.cbegin(); it != part.cend(); ++it) {
+                BucketDigest &digest = digests[it.key()];
+                digest.hash += it->hash;
+                digest.count += it->count;
+            }
+        });
+    });
+}
+
+// Читает сообщения с происхождением без ожидания
+QFuture<DatabaseManager::SyncRecordList> DatabaseManager::syncRecordsAsync(qint64 fromMs, qint64 toMs)
+{
+    QThreadPool *pool = &m_queryPool;
+    ReadConnectionPool *readers = &m_readers;
+    const QStringList paths = originPaths(fromMs, toMs);
+    return QtConcurrent::run(&m_mergePool, [pool, readers, paths, fromMs, toMs]() {
+        return fanOut<SyncRecordList>(pool, paths, [readers, fromMs, toMs](const QString &path) {
+            return querySyncRecords(readers, path, fromMs, toMs);
+        }, [](SyncRecordList &records, const SyncRecordList &part) {
+            records.append(part);
+        });
+    });
+}
+
+// Запускает сбор результатов в пуле m_mergePool; сами файлы читаются в m_queryPool,
+// поэтому сборщик, ожидающий чтения, не может занять все потоки читателей
+QFuture<DatabaseManager::MessageList> DatabaseManager::startQuery(const QStringList &paths, const QString &condition,
+                                                                  const QVariantList &values)
+{
+    QThreadPool *pool = &m_queryPool;
+    ReadConnectionPool *readers = &m_readers;
+    return QtConcurrent::run(&m_mergePool, [pool, readers, paths, condition, values]() {
+        return collectMessages(pool, readers, paths, condition, values);
+    });
+}
+
+// Дожидается фоновых запросов: после waitForDone потоки пулов завершены,
+// и их подключения для чтения можно удалить
+void DatabaseManager::releaseReaders()
+{
+    m_mergePool.waitForDone();
+    m_queryPool.waitForDone();
+    m_readers.closeAll();
+}
+
+// Читает все файлы параллельно и сливает упорядоченные по времени результаты
+DatabaseManager::MessageList DatabaseManager::collectMessages(QThreadPool *pool, ReadConnectionPool *readers,
+                                                              const QStringList &paths, const QString &condition,
+                                                              const QVariantList &values)
+{
+    return fanOut<MessageList>(pool, paths, [readers, condition, values](const QString &path) {
+        return queryMessages(readers, path, condition, values);
+    }, [](MessageList &messages, const MessageList &part) {
+        // Сливаем упорядоченные по времени результаты
+        MessageList merged;
+        merged.reserve(messages.size() + part.size());
+        std::merge(messages.cbegin(), messages.cend(), part.cbegin(), part.cend(),
+                   std::back_inserter(merged),
+                   [](const MessageList::value_type &a, const MessageList::value_type &b) {
+                       return a.first < b.first;
+                   });
+        messages.swap(merged);
+    });
+}
+
+// Читает сообщения по условию из одного файла базы данных
+// Выполняется в потоке пула через подключение этого потока только для чтения,
+// которое остается открытым для следующих запросов
+DatabaseManager::MessageList DatabaseManager::queryMessages(ReadConnectionPool *readers, const QString &path,
+                                                            const QString &condition, const QVariantList &values)
 {
-    QList<QPair<QString, QPair<QString, bool>>> messages;
+    MessageList messages;
+    QSqlDatabase database = readers->connection(path);
+    if (!database.isOpen()) {
+        return messages;
+    }
     
-    // Запрашиваем все сообщения, отсортированные по времени
-    QSqlQuery query("SELECT timestamp, message, direction FROM messages ORDER BY timestamp");
+    QSqlQuery query(database);
+    query.prepare("SELECT timestamp, message, direction FROM messages WHERE "
+                  + condition + " ORDER BY timestamp");
+    for (const QVariant &value : values) {
+        query.addBindValue(value);
+    }
+    
+    if (!query.exec()) {
+        qDebug() << "Ошибка чтения раздела:" << query.lastError().text();
+        return messages;
+    }
     
     // Обрабатываем результаты запроса
     while (query.next()) {
@@ -88,4 +581,124 @@ QList<QPair<QString, QPair<QString, bool>>> DatabaseManager::getMessages()
     }
     
     return messages;
-} 
\ No newline at end of file
+}
+
+// Считает число сообщений и сумму хешей по интервалам origin_time >> shift в одном файле
+// Агрегаты считает SQLite по индексу времени отправки, строки в память не читаются
+DatabaseManager::BucketDigestMap DatabaseManager::queryBucketDigests(ReadConnectionPool *readers, const QString &path,
+                                                                     qint64 fromMs, qint64 toMs, int shift)
+{
+    BucketDigestMap digests;
+    QSqlDatabase database = readers->connection(path);
+    if (!database.isOpen()) {
+        return digests;
+    }
+    
+    QSqlQuery query(database);
+    query.prepare("SELECT origin_time >> ?, count(*), sum(row_hash) FROM messages "
+                  "WHERE origin_id IS NOT NULL AND origin_time >= ? AND origin_time < ? GROUP BY 1");
+    query.addBindValue(shift);
+    query.addBindValue(fromMs);
+    query.addBindValue(toMs);
+    
+    // Файлы, записанные до появления столбцов происхождения, не содержат сообщений для сверки
+    if (!query.exec()) {
+        return digests;
+    }
+    
+    while (query.next()) {
+        BucketDigest &digest = digests[query.value(0).toLongLong()];
+        digest.count = query.value(1).toUInt();
+        digest.hash = query.value(2).toULongLong();
+    }
+    return digests;
+}
+
+// Читает сообщения с происхождением, отправленные в [fromMs, toMs), из одного файла
+DatabaseManager::SyncRecordList DatabaseManager::querySyncRecords(ReadConnectionPool *readers, const QString &path,
+                                                                  qint64 fromMs, qint64 toMs)
+{
+    SyncRecordList records;
+    QSqlDatabase database = readers->connection(path);
+    if (!database.isOpen()) {
+        return records;
+    }
+    
+    QSqlQuery query(database);
+    query.prepare("SELECT origin_id, sequence, origin_time, message FROM messages "
+                  "WHERE origin_id IS NOT NULL AND origin_time >= ? AND origin_time < ?");
+    query.addBindValue(fromMs);
+    query.addBindValue(toMs);
+    
+    // Файлы, записанные до появления столбцов происхождения, не содержат сообщений для сверки
+    if (!query.exec()) {
+        return records;
+    }
+    
+    while (query.next()) {
+        SyncRecord record;
+        record.origin.nodeId = quint64(query.value(0).toLongLong());
+        record.origin.sequence = quint64(query.value(1).toLongLong());
+        record.origin.timeMs = query.value(2).toLongLong();
+        record.message = query.value(3).toString();
+        records.append(record);
+    }
+    return records;
+}
+
+// Возвращает ключи разделов, найденных рядом с основной базой данных
+QStringList DatabaseManager::partitions() const
+{
+    QStringList keys;
+    if (m_dbPath.isEmpty()) {
+        return keys;
+    }
+    
+    QFileInfo info(m_dbPath);
+    const QString prefix = info.completeBaseName() + "_";
+    const QString suffix = info.suffix().isEmpty() ? QString() : "." + info.suffix();
+    
+    const QStringList files = info.dir().entryList({prefix + "*" + suffix}, QDir::Files, QDir::Name);
+    for (const QString &file : files) {
+        const QString key = file.mid(prefix.size(), file.size() - prefix.size() - suffix.size());
+        
+        // Ключ раздела состоит только из цифр: yyyyMM или yyyyMMdd
+        bool isNumber = false;
+        key.toLongLong(&isNumber);
+        if (isNumber && (key.size() == 6 || key.size() == 8)) {
+            keys.append(key);
+        }
+    }
+    
+    keys.sort();
+    return keys;
+}
+
+// Удаляет раздел: стоимость не зависит от числа сообщений в нем, т.к. удаляется файл
+bool DatabaseManager::dropPartition(const QString &key)
+{
+    if (!partitions().contains(key)) {
+        return false;
+    }
+    
+    // Раздел текущей записи будет создан заново при следующем сообщении
+    if (key == m_writer.key) {
+        closeWritePartition(m_writer);
+    }
+    if (key == m_importer.key) {
+        closeWritePartition(m_importer);
+    }
+    // Читатели держат файл раздела открытым
+    releaseReaders();
+    
+    QFile file(partitionPath(key));
+    if (!file.remove()) {
+        qDebug() << "Ошибка удаления раздела:" << file.errorString();
+        return false;
+    }
+    
+    // Файлы журнала WAL обычно удаляются при закрытии последнего подключения
+    QFile::remove(partitionPath(key) + "-wal");
+    QFile::remove(partitionPath(key) + "-shm");
+    return true;
+}
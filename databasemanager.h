@@ -8,16 +8,57 @@
 #include <QDateTime>
 #include <QDebug>
 #include <QList>
+#include <QMap>
 #include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QFuture>
+#include <QVariantList>
+#include "readconnectionpool.h"
+#include "wireprotocol.h"
 
 /*
  * Класс для управления базой данных сообщений
  * Отвечает за подключение к базе данных, создание таблиц и журналирование сообщений
+ * Новые сообщения пишутся в файлы-разделы по дням или месяцам рядом с основной базой,
+ * поэтому запросы по диапазону времени читают только нужные разделы, а удаление
+ * старого раздела сводится к удалению одного файла
+ * Файлы работают в режиме WAL: чтение идет в потоках пула через отдельные
+ * подключения только для чтения и не задерживает журналирование сообщений
+ * Сообщение с известным происхождением (узел, номер, время отправки) хранится
+ * вместе с ним, что позволяет сверять историю разных экземпляров
  */
 class DatabaseManager : public QObject
 {
     Q_OBJECT
 public:
+    // Список сообщений: время, текст и признак входящего сообщения
+    typedef QList<QPair<QString, QPair<QString, bool>>> MessageList;
+
+    // Сообщение с происхождением, которым экземпляры обмениваются при сверке истории
+    struct SyncRecord
+    {
+        WireProtocol::MessageOrigin origin;
+        QString message;
+    };
+    typedef QList<SyncRecord> SyncRecordList;
+
+    // Сводка интервала истории: число сообщений и сумма 32-битных хешей их идентификаторов
+    struct BucketDigest
+    {
+        quint64 hash = 0;
+        quint32 count = 0;
+    };
+    // Сводки интервалов по номерам
+    typedef QMap<qint64, BucketDigest> BucketDigestMap;
+
+    // Схема разбиения истории на разделы
+    enum PartitionScheme {
+        PartitionByDay,
+        PartitionByMonth
+    };
+
     // Конструктор класса
     explicit DatabaseManager(QObject *parent = nullptr);
     // Деструктор класса
@@ -25,16 +66,94 @@ public:
 
     // Открывает соединение с базой данных по указанному пути
     bool openDatabase(const QString &dbPath);
-    // Записывает сообщение в журнал (базу данных)
-    void logMessage(const QString &message, bool incoming);
+    // Задает схему разбиения для новых записей
+    void setPartitionScheme(PartitionScheme scheme);
+    // Записывает сообщение в журнал (базу данных) вместе с его происхождением, если оно известно
+    void logMessage(const QString &message, bool incoming,
+                    const WireProtocol::MessageOrigin &origin = WireProtocol::MessageOrigin());
+    // Запоминает идентификатор узла этого экземпляра: его сообщения считаются исходящими
+    void registerLocalNode(quint64 nodeId);
     // Получает все сообщения из базы данных
-    QList<QPair<QString, QPair<QString, bool>>> getMessages();
+    MessageList getMessages();
+    // Получает сообщения за интервал [from, to); недействительная граница означает отсутствие ограничения
+    MessageList getMessages(const QDateTime &from, const QDateTime &to);
+    // Получает сообщения за интервал в фоновом потоке; результат доступен через QFuture
+    QFuture<MessageList> getMessagesAsync(const QDateTime &from = QDateTime(), const QDateTime &to = QDateTime());
+    // Ищет сообщения, содержащие text, в фоновом потоке
+    QFuture<MessageList> searchMessagesAsync(const QString &text);
+    // Возвращает ключи существующих разделов в порядке возрастания
+    QStringList partitions() const;
+    // Удаляет раздел целиком вместе с его файлом
+    bool dropPartition(const QString &key);
+    // Путь к файлу раздела по его ключу
+    QString partitionPath(const QString &key) const;
+    // Считает в фоне сводки интервалов шириной 2^shift мс среди сообщений, отправленных в [fromMs, toMs)
+    QFuture<BucketDigestMap> bucketDigestsAsync(qint64 fromMs, qint64 toMs, int shift);
+    // Читает в фоне сообщения с происхождением, отправленные в [fromMs, toMs)
+    QFuture<SyncRecordList> syncRecordsAsync(qint64 fromMs, qint64 toMs);
+    // Добавляет сообщения из другой истории, пропуская уже известные; возвращает число записанных
+    int importMessages(const SyncRecordList &records);
 
 private:
     // Объект подключения к базе данных
     QSqlDatabase m_database;
+    // Путь к основной базе данных, рядом с ней хранятся разделы
+    QString m_dbPath;
+    // Схема разбиения для новых записей
+    PartitionScheme m_partitionScheme;
+    // Подключение для записи в один раздел
+    struct PartitionWriter
+    {
+        // Имя подключения QSqlDatabase
+        QString connectionName;
+        QSqlDatabase database;
+        // Ключ открытого раздела; пустой, если подключение закрыто
+        QString key;
+    };
+    // Запись новых сообщений в раздел текущего дня или месяца
+    PartitionWriter m_writer;
+    // Импорт в исторические разделы при сверке: отдельное подключение,
+    // чтобы сверка не переоткрывала раздел текущей записи
+    PartitionWriter m_importer;
+    // Пул потоков для параллельных запросов по разделам
+    QThreadPool m_queryPool;
+    // Пул потоков, собирающих результаты асинхронных запросов из m_queryPool
+    QThreadPool m_mergePool;
+    // Подключения только для чтения, по одному на поток и файл
+    ReadConnectionPool m_readers;
+    // Идентификаторы узлов этого экземпляра за все запуски
+    QSet<quint64> m_localNodes;
+
     // Создает необходимые таблицы в базе данных
     bool createTables();
+    // Ключ раздела для момента времени согласно текущей схеме
+    QString partitionKey(const QDateTime &time) const;
+    // Открывает раздел в подключении для записи, закрывая предыдущий
+    bool openWritePartition(PartitionWriter &writer, const QString &key);
+    // Закрывает подключение к разделу для записи
+    void closeWritePartition(PartitionWriter &writer);
+    // Получает сообщения с метками времени в строковом интервале [fromKey, toKey)
+    MessageList queryRange(const QString &fromKey, const QString &toKey);
+    // Файлы истории, которые могут содержать метки времени из интервала [fromKey, toKey)
+    QStringList queryPaths(const QString &fromKey, const QString &toKey) const;
+    // Файлы истории, которые могут содержать сообщения, отправленные в [fromMs, toMs)
+    QStringList originPaths(qint64 fromMs, qint64 toMs) const;
+    // Запускает чтение файлов в фоне и возвращает будущий результат
+    QFuture<MessageList> startQuery(const QStringList &paths, const QString &condition, const QVariantList &values);
+    // Дожидается завершения фоновых запросов и закрывает подключения для чтения
+    void releaseReaders();
+    // Читает файлы параллельно в пуле pool и сливает результаты по времени
+    static MessageList collectMessages(QThreadPool *pool, ReadConnectionPool *readers, const QStringList &paths,
+                                       const QString &condition, const QVariantList &values);
+    // Читает сообщения одного файла по условию WHERE (выполняется в пуле потоков)
+    static MessageList queryMessages(ReadConnectionPool *readers, const QString &path,
+                                     const QString &condition, const QVariantList &values);
+    // Считает сводки интервалов в одном файле (выполняется в пуле потоков)
+    static BucketDigestMap queryBucketDigests(ReadConnectionPool *readers, const QString &path,
+                                              qint64 fromMs, qint64 toMs, int shift);
+    // Читает сообщения с происхождением из одного файла (выполняется в пуле потоков)
+    static SyncRecordList querySyncRecords(ReadConnectionPool *readers, const QString &path,
+                                           qint64 fromMs, qint64 toMs);
 };
 
-#endif // DATABASEMANAGER_H 
\ No newline at end of file
+#endif // DATABASEMANAGER_H
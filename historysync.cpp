@@ -0,0 +1,567 @@
+#include "historysync.h"
+#include <QFutureWatcher>
+
+namespace {
+
+// Вид сообщения сверки, первый байт тела кадра
+enum SyncMessage : quint8 {
+    // Запрос сводок вложенных интервалов и ответ на него
+    DigestRequest = 1,
+    DigestReply = 2,
+    // Запрос недостающих сообщений интервала и завершающий ответ на него
+    RowsRequest = 3,
+    RowsReply = 4,
+    // Очередная пачка запрошенных сообщений
+    RowsPush = 5,
+    // Просьба провести встречную сверку и извещение о ее завершении
+    ReverseRequest = 6,
+    ReverseDone = 7
+};
+
+// Ширина интервала по уровням дерева, степень двойки в мс:
+// вся история, ~1 год, ~25 дней, ~19 часов, ~70 минут, ~65 секунд
+const int LevelShifts[] = {62, 35, 31, 26, 22, 16};
+const int LeafLevel = 5;
+
+// Число сообщений в одном кадре: пачка записывается одной короткой транзакцией
+// и не превышает MaxFrameSize
+const int PushBatchSize = 250;
+
+// Молчание собеседника, после которого сверка прерывается, мс
+const int SessionTimeoutMs = 30000;
+// Период проверки молчащих собеседников, мс
+const int TimeoutCheckMs = 5000;
+
+// Версия формата QDataStream, одинаковая для сборок с Qt 5 и Qt 6
+const QDataStream::Version StreamVersion = QDataStream::Qt_5_15;
+
+// Начало и конец интервала в мс UTC: [index << shift, (index + 1) << shift)
+qint64 bucketStart(const QPair<quint8, qint64> &bucket)
+{
+    return bucket.second << LevelShifts[bucket.first];
+}
+
+qint64 bucketEnd(const QPair<quint8, qint64> &bucket)
+{
+    return (bucket.second + 1) << LevelShifts[bucket.first];
+}
+
+// Проверяет интервал, пришедший от собеседника, чтобы сдвиги не выходили за 64 бита
+bool isValidBucket(const QPair<quint8, qint64> &bucket)
+{
+    return bucket.first <= LeafLevel && bucket.second >= 0
+            && bucket.second < (qint64(1) << (LevelShifts[0] - LevelShifts[bucket.first]));
+}
+
+void writeRecords(QDataStream &stream, const DatabaseManager::SyncRecordList &records)
+{
+    stream << quint32(records.size());
+    for (const DatabaseManager::SyncRecord &record : records) {
+        stream << record.origin.nodeId << record.origin.sequence << record.origin.timeMs << record.message;
+    }
+}
+
+DatabaseManager::SyncRecordList readRecords(QDataStream &stream)
+{
+    DatabaseManager::SyncRecordList records;
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        DatabaseManager::SyncRecord record;
+        stream >> record.origin.nodeId >> record.origin.sequence >> record.origin.timeMs >> record.message;
+        records.append(record);
+    }
+    return records;
+}
+
+// Вызывает handler в потоке context, когда future получит результат
+template <typename T, typename Handler>
+void onReady(QObject *context, const QFuture<T> &future, Handler handler)
+{
+    auto *watcher = new QFutureWatcher<T>(context);
+    QObject::connect(watcher, &QFutureWatcher<T>::finished, context, [watcher, handler]() {
+        handler(watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(future);
+}
+
+} // namespace
+
+/**
+ * Конструктор обработчика сверки истории
+ *
+ * @param database История этого экземпляра
+ * @param network Транспорт, через который идут кадры сверки
+ * @param parent Родительский объект
+ */
+HistorySync::HistorySync(DatabaseManager *database, NetworkManager *network, QObject *parent)
+    : QObject(parent)
+    , m_database(database)
+    , m_network(network)
+    , m_lastGeneration(0)
+    , m_timeoutTimer(nullptr)
+{
+    connect(m_network, &NetworkManager::syncFrameReceived, this, &HistorySync::onSyncFrameReceived);
+    connect(m_network, &NetworkManager::connectionClosed, this, &HistorySync::onConnectionClosed);
+
+    m_timeoutTimer = new QTimer(this);
+    m_timeoutTimer->setInterval(TimeoutCheckMs);
+    connect(m_timeoutTimer, &QTimer::timeout, this, &HistorySync::onTimeoutCheck);
+    m_clock.start();
+}
+
+/**
+ * Начинает сверку с собеседником: забирает у него недостающие сообщения
+ * и просит его забрать недостающие у себя
+ * Повторный вызов для того же соединения начинает сверку заново
+ *
+ * @param connectionId Идентификатор соединения
+ */
+void HistorySync::synchronize(quint64 connectionId)
+{
+    // Собеседник, ждущий извещения от прежней сверки, получит его от новой
+    const bool notifyPeer = m_sessions.value(connectionId).notifyPeer;
+    startSession(connectionId, true, notifyPeer);
+
+    QByteArray body;
+    QDataStream stream(&body, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << quint8(ReverseRequest);
+    send(connectionId, body);
+
+    requestDigests(connectionId, Bucket(0, 0));
+}
+
+bool HistorySync::isRunning() const
+{
+    return !m_sessions.isEmpty();
+}
+
+void HistorySync::startSession(quint64 connectionId, bool awaitingPeer, bool notifyPeer)
+{
+    Session session;
+    session.generation = ++m_lastGeneration;
+    session.awaitingPeer = awaitingPeer;
+    session.notifyPeer = notifyPeer;
+    session.lastActivityMs = m_clock.elapsed();
+    m_sessions.insert(connectionId, session);
+
+    if (!m_timeoutTimer->isActive()) {
+        m_timeoutTimer->start();
+    }
+}
+
+void HistorySync::onConnectionClosed(quint64 connectionId)
+{
+    if (m_sessions.contains(connectionId)) {
+        abortSession(connectionId);
+    }
+}
+
+/**
+ * Прерывает сверки, от собеседника которых дольше SessionTimeoutMs не было кадров
+ * Так завершаются сверки с версиями, не знающими кадров сверки, и с соединениями,
+ * оборвавшимися без закрытия
+ */
+void HistorySync::onTimeoutCheck()
+{
+    const qint64 nowMs = m_clock.elapsed();
+    const QList<quint64> connectionIds = m_sessions.keys();
+    for (quint64 connectionId : connectionIds) {
+        if (nowMs - m_sessions.value(connectionId).lastActivityMs > SessionTimeoutMs) {
+            qDebug() << "Собеседник не отвечает, сверка прервана:" << connectionId;
+            abortSession(connectionId);
+        }
+    }
+
+    if (m_sessions.isEmpty()) {
+        m_timeoutTimer->stop();
+    }
+}
+
+void HistorySync::abortSession(quint64 connectionId)
+{
+    m_sessions.remove(connectionId);
+    emit aborted(connectionId);
+}
+
+HistorySync::Session *HistorySync::activeSession(quint64 connectionId, quint64 generation)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end() || session->generation != generation) {
+        return nullptr;
+    }
+    return &session.value();
+}
+
+/**
+ * Разбирает кадр сверки и передает его обработчику по виду сообщения
+ *
+ * @param connectionId Соединение, из которого пришел кадр
+ * @param body Тело кадра
+ */
+void HistorySync::onSyncFrameReceived(quint64 connectionId, const QByteArray &body)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session != m_sessions.end()) {
+        session->bytesTransferred += body.size();
+        session->lastActivityMs = m_clock.elapsed();
+    }
+
+    QDataStream stream(body);
+    stream.setVersion(StreamVersion);
+    quint8 kind = 0;
+    stream >> kind;
+
+    switch (kind) {
+    case DigestRequest:
+        handleDigestRequest(connectionId, stream);
+        break;
+    case DigestReply:
+        handleDigestReply(connectionId, stream);
+        break;
+    case RowsRequest:
+        handleRowsRequest(connectionId, stream);
+        break;
+    case RowsReply:
+        handleRowsReply(connectionId, stream);
+        break;
+    case RowsPush:
+        handleRowsPush(connectionId, stream);
+        break;
+    case ReverseRequest:
+        handleReverseRequest(connectionId);
+        break;
+    case ReverseDone:
+        handleReverseDone(connectionId);
+        break;
+    default:
+        qDebug() << "Неизвестный вид сообщения сверки:" << kind;
+        break;
+    }
+}
+
+/**
+ * Отвечает собеседнику сводками вложенных интервалов
+ * Сводки считаются запросом SQL в пуле потоков, ответ уходит по готовности
+ */
+void HistorySync::handleDigestRequest(quint64 connectionId, QDataStream &stream)
+{
+    Bucket bucket;
+    stream >> bucket.first >> bucket.second;
+    if (stream.status() != QDataStream::Ok || !isValidBucket(bucket) || bucket.first == LeafLevel) return;
+
+    const int childShift = LevelShifts[bucket.first + 1];
+    onReady(this, m_database->bucketDigestsAsync(bucketStart(bucket), bucketEnd(bucket), childShift),
+            [this, connectionId, bucket](const DatabaseManager::BucketDigestMap &digests) {
+        QByteArray body;
+        QDataStream reply(&body, QIODevice::WriteOnly);
+        reply.setVersion(StreamVersion);
+        reply << quint8(DigestReply) << bucket.first << bucket.second << quint32(digests.size());
+        for (auto it = digests.cbegin(); it != digests.cend(); ++it) {
+            reply << it.key() << it->hash << it->count;
+        }
+        send(connectionId, body);
+    });
+}
+
+/**
+ * Принимает сводки собеседника по запрошенному интервалу и сравнивает их
+ * со своими, как только те будут посчитаны
+ */
+void HistorySync::handleDigestReply(quint64 connectionId, QDataStream &stream)
+{
+    Bucket bucket;
+    quint32 count = 0;
+    stream >> bucket.first >> bucket.second >> count;
+
+    DatabaseManager::BucketDigestMap theirs;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        qint64 index = 0;
+        DatabaseManager::BucketDigest digest;
+        stream >> index >> digest.hash >> digest.count;
+        theirs.insert(index, digest);
+    }
+    if (stream.status() != QDataStream::Ok) return;
+
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end() || !session->requestedDigests.remove(bucket)) return;
+
+    // Ответ остается незавершенным шагом, пока не посчитаны свои сводки
+    const quint64 generation = session->generation;
+    const int childShift = LevelShifts[bucket.first + 1];
+    onReady(this, m_database->bucketDigestsAsync(bucketStart(bucket), bucketEnd(bucket), childShift),
+            [this, connectionId, generation, bucket, theirs](const DatabaseManager::BucketDigestMap &ours) {
+        compareDigests(connectionId, generation, bucket, ours, theirs);
+    });
+}
+
+/**
+ * Спускается в интервалы, сводки которых отличаются
+ * Интервалы, которых нет у собеседника, пропускаются: их он заберет во встречной
+ * сверке. Интервал, которого нет у нас, запрашивается целиком, в самых мелких
+ * интервалах собеседнику сообщаются идентификаторы уже известных сообщений
+ */
+void HistorySync::compareDigests(quint64 connectionId, quint64 generation, const Bucket &bucket,
+                                 const DatabaseManager::BucketDigestMap &ours,
+                                 const DatabaseManager::BucketDigestMap &theirs)
+{
+    if (!activeSession(connectionId, generation)) return;
+
+    const quint8 childLevel = bucket.first + 1;
+    for (auto it = theirs.cbegin(); it != theirs.cend(); ++it) {
+        const Bucket child(childLevel, it.key());
+        // Вложенный интервал должен лежать внутри запрошенного
+        if (!isValidBucket(child) || bucketStart(child) < bucketStart(bucket)
+                || bucketStart(child) >= bucketEnd(bucket)) {
+            continue;
+        }
+
+        const DatabaseManager::BucketDigest mine = ours.value(it.key());
+        if (mine.hash == it->hash && mine.count == it->count) {
+            continue;
+        }
+
+        if (mine.count == 0) {
+            requestRows(connectionId, child, QList<QPair<quint64, quint64>>());
+        } else if (childLevel == LeafLevel) {
+            requestMissingRows(connectionId, child);
+        } else {
+            requestDigests(connectionId, child);
+        }
+    }
+
+    completeStep(connectionId);
+}
+
+/**
+ * Отправляет сообщения интервала, которых нет среди известных собеседнику,
+ * и завершающий ответ; сообщения уходят раньше него, поэтому к его приходу они уже записаны
+ */
+void HistorySync::handleRowsRequest(quint64 connectionId, QDataStream &stream)
+{
+    Bucket bucket;
+    QList<QPair<quint64, quint64>> knownList;
+    stream >> bucket.first >> bucket.second >> knownList;
+    if (stream.status() != QDataStream::Ok || !isValidBucket(bucket)) return;
+
+    const QSet<QPair<quint64, quint64>> known(knownList.cbegin(), knownList.cend());
+    onReady(this, m_database->syncRecordsAsync(bucketStart(bucket), bucketEnd(bucket)),
+            [this, connectionId, bucket, known](const DatabaseManager::SyncRecordList &records) {
+        DatabaseManager::SyncRecordList missing;
+        for (const DatabaseManager::SyncRecord &record : records) {
+            if (!known.contains(qMakePair(record.origin.nodeId, record.origin.sequence))) {
+                missing.append(record);
+            }
+        }
+        pushRows(connectionId, bucket, missing);
+
+        QByteArray body;
+        QDataStream reply(&body, QIODevice::WriteOnly);
+        reply.setVersion(StreamVersion);
+        reply << quint8(RowsReply) << bucket.first << bucket.second;
+        send(connectionId, body);
+    });
+}
+
+/**
+ * Завершает запрос сообщений интервала
+ */
+void HistorySync::handleRowsReply(quint64 connectionId, QDataStream &stream)
+{
+    Bucket bucket;
+    stream >> bucket.first >> bucket.second;
+    if (stream.status() != QDataStream::Ok) return;
+
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end() || !session->requestedRows.remove(bucket)) return;
+
+    completeStep(connectionId);
+}
+
+/**
+ * Записывает в историю сообщения, запрошенные у собеседника
+ * Пачки вне своей сверки, для незапрошенного интервала и сообщения
+ * за пределами интервала отбрасываются
+ */
+void HistorySync::handleRowsPush(quint64 connectionId, QDataStream &stream)
+{
+    Bucket bucket;
+    stream >> bucket.first >> bucket.second;
+    const DatabaseManager::SyncRecordList records = readRecords(stream);
+    if (stream.status() != QDataStream::Ok) return;
+
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end() || !session->requestedRows.contains(bucket)) {
+        qDebug() << "Отклонены незапрошенные сообщения сверки от соединения" << connectionId;
+        return;
+    }
+
+    DatabaseManager::SyncRecordList accepted;
+    for (const DatabaseManager::SyncRecord &record : records) {
+        if (record.origin.isValid() && record.origin.timeMs >= bucketStart(bucket)
+                && record.origin.timeMs < bucketEnd(bucket)) {
+            accepted.append(record);
+        }
+    }
+
+    session->messagesReceived += m_database->importMessages(accepted);
+}
+
+/**
+ * Проводит встречную сверку по просьбе собеседника и извещает его о завершении
+ * Если своя сверка с ним уже идет, извещение уйдет по ее завершении
+ */
+void HistorySync::handleReverseRequest(quint64 connectionId)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session != m_sessions.end()) {
+        session->notifyPeer = true;
+        finishIfDone(connectionId);
+        return;
+    }
+
+    startSession(connectionId, false, true);
+    requestDigests(connectionId, Bucket(0, 0));
+}
+
+void HistorySync::handleReverseDone(quint64 connectionId)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end()) return;
+
+    session->awaitingPeer = false;
+    finishIfDone(connectionId);
+}
+
+void HistorySync::requestDigests(quint64 connectionId, const Bucket &bucket)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end()) return;
+    ++session->outstanding;
+    session->requestedDigests.insert(bucket);
+
+    QByteArray body;
+    QDataStream stream(&body, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << quint8(DigestRequest) << bucket.first << bucket.second;
+    send(connectionId, body);
+}
+
+void HistorySync::requestMissingRows(quint64 connectionId, const Bucket &bucket)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end()) return;
+    ++session->outstanding;
+
+    const quint64 generation = session->generation;
+    onReady(this, m_database->syncRecordsAsync(bucketStart(bucket), bucketEnd(bucket)),
+            [this, connectionId, generation, bucket](const DatabaseManager::SyncRecordList &records) {
+        if (!activeSession(connectionId, generation)) return;
+
+        QList<QPair<quint64, quint64>> known;
+        known.reserve(records.size());
+        for (const DatabaseManager::SyncRecord &record : records) {
+            known.append(qMakePair(record.origin.nodeId, record.origin.sequence));
+        }
+        requestRows(connectionId, bucket, known);
+        completeStep(connectionId);
+    });
+}
+
+void HistorySync::requestRows(quint64 connectionId, const Bucket &bucket, const QList<QPair<quint64, quint64>> &known)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end()) return;
+    ++session->outstanding;
+    session->requestedRows.insert(bucket);
+
+    QByteArray body;
+    QDataStream stream(&body, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << quint8(RowsRequest) << bucket.first << bucket.second << known;
+    send(connectionId, body);
+}
+
+/**
+ * Отправляет сообщения пачками по PushBatchSize
+ *
+ * @param connectionId Идентификатор соединения
+ * @param bucket Интервал, сообщения которого запросил собеседник
+ * @param records Сообщения, которых нет у собеседника
+ */
+void HistorySync::pushRows(quint64 connectionId, const Bucket &bucket, const DatabaseManager::SyncRecordList &records)
+{
+    for (int start = 0; start < records.size(); start += PushBatchSize) {
+        QByteArray body;
+        QDataStream stream(&body, QIODevice::WriteOnly);
+        stream.setVersion(StreamVersion);
+        stream << quint8(RowsPush) << bucket.first << bucket.second;
+        writeRecords(stream, records.mid(start, PushBatchSize));
+        send(connectionId, body);
+    }
+
+    auto session = m_sessions.find(connectionId);
+    if (session != m_sessions.end()) {
+        session->messagesSent += records.size();
+    }
+}
+
+void HistorySync::send(quint64 connectionId, const QByteArray &body)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session != m_sessions.end()) {
+        session->bytesTransferred += body.size();
+    }
+
+    // Соединение закрыто: ответов уже не будет, сверка прерывается
+    if (!m_network->sendSyncFrame(connectionId, body) && m_sessions.contains(connectionId)) {
+        abortSession(connectionId);
+    }
+}
+
+void HistorySync::completeStep(quint64 connectionId)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end()) return;
+
+    --session->outstanding;
+    finishIfDone(connectionId);
+}
+
+/**
+ * Завершает сверку, когда все недостающие сообщения получены
+ * Собеседника, просившего о ней, извещаем сразу, даже если сами еще ждем
+ * его встречной сверки: иначе одновременные сверки ждали бы друг друга
+ */
+void HistorySync::finishIfDone(quint64 connectionId)
+{
+    auto session = m_sessions.find(connectionId);
+    if (session == m_sessions.end() || session->outstanding > 0) {
+        return;
+    }
+
+    if (session->notifyPeer) {
+        session->notifyPeer = false;
+
+        QByteArray body;
+        QDataStream stream(&body, QIODevice::WriteOnly);
+        stream.setVersion(StreamVersion);
+        stream << quint8(ReverseDone);
+        send(connectionId, body);
+
+        session = m_sessions.find(connectionId);
+        if (session == m_sessions.end()) {
+            return;
+        }
+    }
+
+    if (session->awaitingPeer) {
+        return;
+    }
+
+    const Session done = *session;
+    m_sessions.erase(session);
+    emit finished(connectionId, done.messagesReceived, done.messagesSent, done.bytesTransferred);
+}
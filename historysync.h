@@ -0,0 +1,125 @@
+#ifndef HISTORYSYNC_H
+#define HISTORYSYNC_H
+
+#include <QObject>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QTimer>
+#include "databasemanager.h"
+#include "networkmanager.h"
+
+/*
+ * Сверка истории сообщений двух экземпляров чата
+ * Сообщения сравниваются по происхождению (узел, номер, время отправки),
+ * которое одинаково у всех экземпляров, поэтому различия в тексте подписи,
+ * направлении и времени записи на сверку не влияют. История делится на вложенные
+ * интервалы времени отправки; для каждого интервала SQLite считает сводку -
+ * число сообщений и сумму хешей идентификаторов, не зависящую от порядка.
+ * Сторона, начавшая сверку, сравнивает сводки сверху вниз, спускается только
+ * в отличающиеся интервалы и забирает недостающие сообщения. Затем собеседник
+ * по ее просьбе проводит такую же встречную сверку. Сообщения принимаются
+ * только в ответ на собственный запрос и только из запрошенного интервала.
+ * Сверка прерывается при закрытии соединения и при долгом молчании собеседника.
+ * Сообщения, записанные без происхождения, в сверке не участвуют
+ */
+class HistorySync : public QObject
+{
+    Q_OBJECT
+public:
+    // Создает обработчик сверки; ответы на запросы собеседника отправляются автоматически
+    HistorySync(DatabaseManager *database, NetworkManager *network, QObject *parent = nullptr);
+
+    // Начинает сверку истории с собеседником по соединению
+    void synchronize(quint64 connectionId);
+    // Признак незавершенной сверки с каким-либо соединением
+    bool isRunning() const;
+
+signals:
+    // Сверка с соединением завершена: сколько сообщений получено, отправлено и байт передано
+    void finished(quint64 connectionId, int messagesReceived, int messagesSent, qint64 bytesTransferred);
+    // Сверка с соединением прервана: соединение закрыто или собеседник не отвечает
+    void aborted(quint64 connectionId);
+
+private slots:
+    // Обрабатывает кадр сверки от собеседника
+    void onSyncFrameReceived(quint64 connectionId, const QByteArray &body);
+    // Прерывает сверку с закрытым соединением
+    void onConnectionClosed(quint64 connectionId);
+    // Прерывает сверки, собеседник которых давно не присылал кадров
+    void onTimeoutCheck();
+
+private:
+    // Интервал времени отправки: уровень дерева и номер интервала на этом уровне
+    typedef QPair<quint8, qint64> Bucket;
+
+    // Состояние сверки, в которой этот экземпляр забирает недостающие сообщения
+    struct Session
+    {
+        // Номер сверки: результаты фоновых чтений прежней сверки того же соединения отбрасываются
+        quint64 generation = 0;
+        // Запросы без ответа и незавершенные фоновые чтения своей истории
+        int outstanding = 0;
+        // Интервалы, сводки и сообщения которых запрошены у собеседника
+        QSet<Bucket> requestedDigests;
+        QSet<Bucket> requestedRows;
+        // Собеседник еще не завершил встречную сверку
+        bool awaitingPeer = false;
+        // Собеседник ждет извещения о том, что эта сверка завершена
+        bool notifyPeer = false;
+        // Время последнего кадра сверки по часам m_clock, мс
+        qint64 lastActivityMs = 0;
+        int messagesReceived = 0;
+        int messagesSent = 0;
+        qint64 bytesTransferred = 0;
+    };
+
+    // Обработчики сообщений сверки
+    void handleDigestRequest(quint64 connectionId, QDataStream &stream);
+    void handleDigestReply(quint64 connectionId, QDataStream &stream);
+    void handleRowsRequest(quint64 connectionId, QDataStream &stream);
+    void handleRowsReply(quint64 connectionId, QDataStream &stream);
+    void handleRowsPush(quint64 connectionId, QDataStream &stream);
+    void handleReverseRequest(quint64 connectionId);
+    void handleReverseDone(quint64 connectionId);
+
+    // Создает сверку с соединением, заменяя незавершенную
+    void startSession(quint64 connectionId, bool awaitingPeer, bool notifyPeer);
+    // Сверка соединения, если она еще та же, что и при запуске фонового чтения
+    Session *activeSession(quint64 connectionId, quint64 generation);
+    // Сравнивает сводки вложенных интервалов bucket и запрашивает отличающиеся
+    void compareDigests(quint64 connectionId, quint64 generation, const Bucket &bucket,
+                        const DatabaseManager::BucketDigestMap &ours,
+                        const DatabaseManager::BucketDigestMap &theirs);
+    // Запрашивает у собеседника сводки вложенных интервалов
+    void requestDigests(quint64 connectionId, const Bucket &bucket);
+    // Читает свои сообщения интервала и запрашивает у собеседника остальные
+    void requestMissingRows(quint64 connectionId, const Bucket &bucket);
+    // Запрашивает сообщения интервала, которых нет среди перечисленных идентификаторов
+    void requestRows(quint64 connectionId, const Bucket &bucket, const QList<QPair<quint64, quint64>> &known);
+    // Отправляет собеседнику запрошенные сообщения
+    void pushRows(quint64 connectionId, const Bucket &bucket, const DatabaseManager::SyncRecordList &records);
+    // Отправляет тело кадра сверки и учитывает его размер
+    void send(quint64 connectionId, const QByteArray &body);
+    // Отмечает завершение запроса или фонового чтения и проверяет, не закончена ли сверка
+    void completeStep(quint64 connectionId);
+    // Завершает сверку, если ответов больше не ожидается
+    void finishIfDone(quint64 connectionId);
+    // Удаляет незавершенную сверку и сообщает о ее прерывании
+    void abortSession(quint64 connectionId);
+
+    DatabaseManager *m_database;
+    NetworkManager *m_network;
+    // Сверки, в которых этот экземпляр забирает сообщения, по идентификаторам соединений
+    QHash<quint64, Session> m_sessions;
+    // Номер последней начатой сверки
+    quint64 m_lastGeneration;
+    // Периодическая проверка молчащих собеседников, работает при незавершенных сверках
+    QTimer *m_timeoutTimer;
+    // Монотонные часы для учета активности сверок
+    QElapsedTimer m_clock;
+};
+
+#endif // HISTORYSYNC_H
@@ -1,12 +1,63 @@
 #include "mainwindow.h"
+#include "partitiontool.h"
+#include "relaynode.h"
+#include "replaytool.h"
+#include "tlsbenchmark.h"
 
 #include <QApplication>
+#include <QCoreApplication>
 #include <QCommandLineParser>
 
+namespace {
+
+// Режимы без окна: работают и на машине без дисплея, поэтому обходятся QCoreApplication
+const char *const HeadlessModes[] = {"--bench-tls", "--replay", "--partitions", "--relay-node"};
+
+// Признак режима без окна; проверяется до создания приложения
+bool isHeadless(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        for (const char *mode : HeadlessModes) {
+            if (qstrcmp(argv[i], mode) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Запускает режим без окна по аргументам командной строки
+int runHeadless(const QStringList &arguments)
+{
+    // Режим замера TLS завершается после вывода результатов
+    if (arguments.contains("--bench-tls")) {
+        return runTlsBenchmark(arguments);
+    }
+
+    // Режим воспроизведения записанного трафика
+    if (arguments.contains("--replay")) {
+        return runReplay(arguments);
+    }
+
+    // Обслуживание разделов истории: просмотр и удаление устаревших
+    if (arguments.contains("--partitions")) {
+        return runPartitionTool(arguments);
+    }
+
+    // Узел-ретранслятор для горизонтального масштабирования
+    return runRelayNode(arguments);
+}
+
+} // namespace
+
 int main(int argc, char *argv[])
 {
+    if (isHeadless(argc, argv)) {
+        QCoreApplication a(argc, argv);
+        return runHeadless(a.arguments());
+    }
+
     QApplication a(argc, argv);
-    
     MainWindow w;
     w.show();
     return a.exec();
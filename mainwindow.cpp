@@ -1,5 +1,6 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "tracer.h"
 #include <QDateTime>
 #include <QCoreApplication>
 #include <QTableWidget>
@@ -8,6 +9,62 @@
 #include <QDialog>
 #include <QPushButton>
 #include <QHeaderView>
+#include <QFutureWatcher>
+#include <QLineEdit>
+#include <QTimer>
+
+namespace {
+
+// Число строк таблицы истории, заполняемых за одну итерацию цикла событий
+const int TableFillBatchSize = 2000;
+
+/*
+ * Заполняет таблицу истории порциями, чтобы большая выборка не задерживала
+ * отрисовку окна. Новая выборка прерывает заполнение предыдущей
+ */
+void fillMessageTable(QTableWidget *tableWidget, const DatabaseManager::MessageList &messages, int start)
+{
+    if (start == 0) {
+        tableWidget->setProperty("fillGeneration", tableWidget->property("fillGeneration").toInt() + 1);
+        // Устанавливаем количество строк в таблице равным количеству сообщений
+        tableWidget->clearContents();
+        tableWidget->setRowCount(messages.size());
+    }
+    
+    // Заполняем таблицу данными из базы данных
+    const int end = qMin(int(messages.size()), start + TableFillBatchSize);
+    for (int i = start; i < end; ++i) {
+        // Получаем данные текущего сообщения
+        QPair<QString, QPair<QString, bool>> messageData = messages.at(i);
+        
+        // Извлекаем компоненты сообщения
+        QString timestamp = messageData.first;  // Временная метка
+        QString message = messageData.second.first;  // Текст сообщения
+        bool isIncoming = messageData.second.second;  // Направление (входящее/исходящее)
+        
+        // Создаем элементы таблицы для каждого столбца
+        QTableWidgetItem *timestampItem = new QTableWidgetItem(timestamp);
+        QTableWidgetItem *messageItem = new QTableWidgetItem(message);
+        QTableWidgetItem *directionItem = new QTableWidgetItem(isIncoming ? "Входящее" : "Исходящее");
+        
+        // Устанавливаем элементы в соответствующие ячейки таблицы
+        tableWidget->setItem(i, 0, timestampItem);
+        tableWidget->setItem(i, 1, messageItem);
+        tableWidget->setItem(i, 2, directionItem);
+    }
+    
+    // Остаток заполняем на следующих итерациях, если таблицу не заняла новая выборка
+    if (end < messages.size()) {
+        const int generation = tableWidget->property("fillGeneration").toInt();
+        QTimer::singleShot(0, tableWidget, [tableWidget, messages, end, generation]() {
+            if (tableWidget->property("fillGeneration").toInt() == generation) {
+                fillMessageTable(tableWidget, messages, end);
+            }
+        });
+    }
+}
+
+} // namespace
 
 /**
  * Конструктор класса MainWindow
@@ -32,11 +89,24 @@ MainWindow::MainWindow(QWidget *parent)
     connect(m_networkManager, &NetworkManager::disconnected, this, &MainWindow::onDisconnected);
     connect(m_networkManager, &NetworkManager::error, this, &MainWindow::onError);
     
+    // Настраиваем транспорт по аргументам командной строки
+    processNetworkOptions();
+    
     // Создаем менеджер базы данных для журналирования сообщений
     m_databaseManager = new DatabaseManager(this);
     
     // Открываем базу данных, используя путь из аргументов командной строки
     processDatabasePath();
+    // Сообщения этого узла при сверке истории считаются исходящими
+    m_databaseManager->registerLocalNode(m_networkManager->nodeId());
+    
+    // Включаем трассировку сообщений, если она запрошена в аргументах
+    processTraceOptions();
+    
+    // Сверка истории отвечает собеседникам, даже если мы ее не запускали
+    m_historySync = new HistorySync(m_databaseManager, m_networkManager, this);
+    connect(m_historySync, &HistorySync::finished, this, &MainWindow::onSyncFinished);
+    connect(m_historySync, &HistorySync::aborted, this, &MainWindow::onSyncAborted);
     
     // Связываем события элементов интерфейса с соответствующими слотами
     connect(ui->startServerButton, &QPushButton::clicked, this, &MainWindow::onStartServer);
@@ -44,6 +114,7 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->sendButton, &QPushButton::clicked, this, &MainWindow::onSendMessage);
     connect(ui->messageEdit, &QLineEdit::returnPressed, this, &MainWindow::onSendMessage);
     connect(ui->showDbButton, &QPushButton::clicked, this, &MainWindow::onShowDatabase);
+    connect(ui->syncButton, &QPushButton::clicked, this, &MainWindow::onSyncHistory);
     
     // Устанавливаем заголовок главного окна
     setWindowTitle("Простой чат");
@@ -60,6 +131,11 @@ MainWindow::~MainWindow()
         m_networkManager->closeConnections();
     }
     
+    // Сохраняем накопленные спаны трассировки
+    if (!m_tracePath.isEmpty()) {
+        Tracer::writeChromeTrace(m_tracePath);
+    }
+    
     // Освобождаем память, занятую пользовательским интерфейсом
     delete ui;
 }
@@ -68,6 +144,7 @@ MainWindow::~MainWindow()
  * Обрабатывает аргументы командной строки для определения пути к базе данных
  * Ищет аргумент --db и открывает базу данных по указанному пути
  * При отсутствии аргумента использует базу данных по умолчанию "chat.db"
+ * Аргумент --partition day|month задает разбиение истории на разделы
  */
 void MainWindow::processDatabasePath()
 {
@@ -82,7 +159,10 @@ void MainWindow::processDatabasePath()
         if (args[i] == "--db" && i + 1 < args.size()) {
             // Если найден аргумент --db и за ним следует значение, используем его
             dbPath = args[i + 1];
-            break;
+        } else if (args[i] == "--partition" && i + 1 < args.size()) {
+            // Разделы по дням удобны при большом потоке сообщений и коротком сроке хранения
+            m_databaseManager->setPartitionScheme(args[i + 1] == "day" ? DatabaseManager::PartitionByDay
+                                                                        : DatabaseManager::PartitionByMonth);
         }
     }
     
@@ -94,6 +174,104 @@ void MainWindow::processDatabasePath()
     }
 }
 
+/**
+ * Обрабатывает аргументы командной строки для трассировки сообщений
+ * Аргумент --trace задает файл для трассы в формате Chrome trace-event JSON,
+ * аргумент --trace-sample задает долю трассируемых сообщений (по умолчанию 1)
+ */
+void MainWindow::processTraceOptions()
+{
+    QStringList args = QCoreApplication::arguments();
+    double sampleRate = 1.0;
+    
+    for (int i = 1; i + 1 < args.size(); ++i) {
+        if (args[i] == "--trace") {
+            m_tracePath = args[i + 1];
+        } else if (args[i] == "--trace-sample") {
+            sampleRate = args[i + 1].toDouble();
+        }
+    }
+    
+    // Без файла трассы спаны не записываются вовсе
+    if (m_tracePath.isEmpty()) return;
+    
+    Tracer::setSampleRate(sampleRate);
+    Tracer::setEnabled(true);
+}
+
+/**
+ * Обрабатывает аргументы командной строки для сетевого транспорта
+ * Пара аргументов --tls-cert и --tls-key включает шифрование TLS
+ * для сервера и исходящих подключений.
+ * Аргументы --tcp-nodelay, --tcp-keepalive (0 или 1), --tcp-sndbuf, --tcp-rcvbuf (байты)
+ * и --coalesce-ms настраивают сокеты и объединение записей,
+ * --ping-interval-ms и --idle-timeout-ms задают проверку активности соединений,
+ * --capture включает запись трафика в файл,
+ * --listen запускает сервер при старте, а --peer (можно несколько раз)
+ * добавляет соседний ретранслятор и включает режим ретрансляции
+ */
+void MainWindow::processNetworkOptions()
+{
+    QStringList args = QCoreApplication::arguments();
+    QString certificatePath;
+    QString keyPath;
+    QString capturePath;
+    QStringList peers;
+    int listenPort = 0;
+    NetworkManager::SocketOptions options = m_networkManager->socketOptions();
+    
+    for (int i = 1; i + 1 < args.size(); ++i) {
+        if (args[i] == "--tls-cert") {
+            certificatePath = args[i + 1];
+        } else if (args[i] == "--tls-key") {
+            keyPath = args[i + 1];
+        } else if (args[i] == "--tcp-nodelay") {
+            options.lowDelay = args[i + 1] != "0";
+        } else if (args[i] == "--tcp-keepalive") {
+            options.keepAlive = args[i + 1] != "0";
+        } else if (args[i] == "--tcp-sndbuf") {
+            options.sendBufferSize = args[i + 1].toInt();
+        } else if (args[i] == "--tcp-rcvbuf") {
+            options.receiveBufferSize = args[i + 1].toInt();
+        } else if (args[i] == "--coalesce-ms") {
+            options.maxCoalesceDelayMs = qMax(0, args[i + 1].toInt());
+        } else if (args[i] == "--ping-interval-ms") {
+            options.pingIntervalMs = qMax(0, args[i + 1].toInt());
+        } else if (args[i] == "--idle-timeout-ms") {
+            options.idleTimeoutMs = qMax(0, args[i + 1].toInt());
+        } else if (args[i] == "--capture") {
+            capturePath = args[i + 1];
+        } else if (args[i] == "--listen") {
+            listenPort = args[i + 1].toInt();
+        } else if (args[i] == "--peer") {
+            peers.append(args[i + 1]);
+        }
+    }
+    
+    m_networkManager->setSocketOptions(options);
+    
+    // Запись трафика для последующего воспроизведения через --replay
+    if (!capturePath.isEmpty()) {
+        m_networkManager->startCapture(capturePath);
+    }
+    
+    // TLS включается до запуска сервера и подключения к ретрансляторам
+    if (!certificatePath.isEmpty() && !keyPath.isEmpty()
+        && !m_networkManager->setTlsCredentials(certificatePath, keyPath)) {
+        QMessageBox::warning(this, "Ошибка TLS",
+                             "Не удалось загрузить сертификат. Соединения будут без шифрования.");
+    }
+    
+    // Сервер, запущенный сразу при старте, и соседние ретрансляторы
+    if (listenPort > 0 && m_networkManager->startServer(listenPort)) {
+        m_serverPort = listenPort;
+        ui->statusbar->showMessage("Сервер запущен на порту " + QString::number(listenPort));
+    }
+    for (const QString &peer : peers) {
+        m_networkManager->addRelayPeer(peer.section(':', 0, 0), peer.section(':', 1, 1).toInt());
+    }
+}
+
 /**
  * Обрабатывает нажатие на кнопку "Запустить сервер"
  * Запрашивает у пользователя порт и запускает серверную часть чата
@@ -168,11 +346,14 @@ void MainWindow::onSendMessage()
     // Если сообщение пустое, не отправляем его
     if (message.isEmpty()) return;
     
+    // Начинаем трассу сообщения, если оно попало в выборку
+    TraceSpan span("ui.send", Tracer::startTrace());
+    
     // Отправляем сообщение через сетевой менеджер
-    m_networkManager->sendMessage(message);
+    const WireProtocol::MessageOrigin origin = m_networkManager->sendMessage(message);
     
     // Отображаем отправленное сообщение в окне чата
-    displayMessage("Вы: " + message, false);
+    displayMessage(message, false, origin);
     
     // Очищаем поле ввода для следующего сообщения
     ui->messageEdit->clear();
@@ -182,26 +363,30 @@ void MainWindow::onSendMessage()
  * Обрабатывает получение нового сообщения от собеседника
  * Вызывается при получении сигнала messageReceived от сетевого менеджера
  */
-void MainWindow::onMessageReceived(const QString &message)
+void MainWindow::onMessageReceived(const QString &message, const WireProtocol::MessageOrigin &origin)
 {
     // Отображаем полученное сообщение в окне чата
-    displayMessage("Собеседник: " + message, true);
+    displayMessage(message, true, origin);
 }
 
 /**
  * Отображает сообщение в окне чата и записывает его в базу данных
- * Добавляет временную метку и форматирует сообщение
+ * Добавляет временную метку и подпись отправителя; в базу попадает
+ * исходный текст, одинаковый у всех экземпляров
  */
-void MainWindow::displayMessage(const QString &message, bool incoming)
+void MainWindow::displayMessage(const QString &message, bool incoming, const WireProtocol::MessageOrigin &origin)
 {
     // Формируем временную метку в формате [ЧЧ:ММ:СС]
     QString timeStamp = QDateTime::currentDateTime().toString("[hh:mm:ss]");
     
     // Добавляем сообщение с временной меткой в окно чата
-    ui->chatDisplay->appendPlainText(timeStamp + " " + message);
+    {
+        TraceSpan span("ui.display");
+        ui->chatDisplay->appendPlainText(timeStamp + " " + (incoming ? "Собеседник: " : "Вы: ") + message);
+    }
     
     // Записываем сообщение в базу данных для журналирования
-    m_databaseManager->logMessage(message, incoming);
+    m_databaseManager->logMessage(message, incoming, origin);
 }
 
 /**
@@ -242,6 +427,8 @@ void MainWindow::onShowDatabase()
 {
     // Создаем новое диалоговое окно как дочернее для главного окна
     QDialog *dbDialog = new QDialog(this);
+    // Диалог удаляется после закрытия вместе с наблюдателем незавершенного запроса
+    dbDialog->setAttribute(Qt::WA_DeleteOnClose);
     
     // Устанавливаем заголовок и размеры диалогового окна
     dbDialog->setWindowTitle("Содержимое базы данных");
@@ -260,43 +447,77 @@ void MainWindow::onShowDatabase()
     // Настраиваем автоматическое изменение ширины столбцов
     tableWidget->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
     
+    // Создаем поле поиска по тексту сообщений
+    QLineEdit *searchEdit = new QLineEdit(dbDialog);
+    searchEdit->setPlaceholderText("Поиск по тексту (Enter)");
+    
     // Создаем кнопку закрытия диалога
     QPushButton *closeButton = new QPushButton("Закрыть", dbDialog);
+    // Enter в поле поиска не должен закрывать диалог
+    closeButton->setAutoDefault(false);
     
     // Подключаем сигнал нажатия на кнопку к закрытию диалога
     connect(closeButton, &QPushButton::clicked, dbDialog, &QDialog::accept);
     
-    // Добавляем таблицу и кнопку в компоновку
+    // Добавляем поле поиска, таблицу и кнопку в компоновку
+    layout->addWidget(searchEdit);
     layout->addWidget(tableWidget);
     layout->addWidget(closeButton);
     
-    // Получаем все сообщения из базы данных
-    QList<QPair<QString, QPair<QString, bool>>> messages = m_databaseManager->getMessages();
+    // Сообщения читаются в фоновых потоках: диалог открывается сразу,
+    // а таблица заполняется, когда результат готов
+    auto *watcher = new QFutureWatcher<DatabaseManager::MessageList>(dbDialog);
+    connect(watcher, &QFutureWatcherBase::finished, dbDialog, [watcher, tableWidget]() {
+        fillMessageTable(tableWidget, watcher->result(), 0);
+    });
     
-    // Устанавливаем количество строк в таблице равным количеству сообщений
-    tableWidget->setRowCount(messages.size());
+    // Пустая строка поиска возвращает всю историю
+    connect(searchEdit, &QLineEdit::returnPressed, dbDialog, [this, watcher, searchEdit]() {
+        const QString text = searchEdit->text().trimmed();
+        watcher->setFuture(text.isEmpty() ? m_databaseManager->getMessagesAsync()
+                                          : m_databaseManager->searchMessagesAsync(text));
+    });
     
-    // Заполняем таблицу данными из базы данных
-    for (int i = 0; i < messages.size(); ++i) {
-        // Получаем данные текущего сообщения
-        QPair<QString, QPair<QString, bool>> messageData = messages.at(i);
-        
-        // Извлекаем компоненты сообщения
-        QString timestamp = messageData.first;  // Временная метка
-        QString message = messageData.second.first;  // Текст сообщения
-        bool isIncoming = messageData.second.second;  // Направление (входящее/исходящее)
-        
-        // Создаем элементы таблицы для каждого столбца
-        QTableWidgetItem *timestampItem = new QTableWidgetItem(timestamp);
-        QTableWidgetItem *messageItem = new QTableWidgetItem(message);
-        QTableWidgetItem *directionItem = new QTableWidgetItem(isIncoming ? "Входящее" : "Исходящее");
-        
-        // Устанавливаем элементы в соответствующие ячейки таблицы
-        tableWidget->setItem(i, 0, timestampItem);
-        tableWidget->setItem(i, 1, messageItem);
-        tableWidget->setItem(i, 2, directionItem);
-    }
+    // Получаем все сообщения из базы данных
+    watcher->setFuture(m_databaseManager->getMessagesAsync());
     
     // Отображаем модальное диалоговое окно
     dbDialog->exec();
 }
+
+/**
+ * Запускает сверку истории со всеми собеседниками
+ * Вызывается при нажатии на кнопку "Синхронизация"
+ */
+void MainWindow::onSyncHistory()
+{
+    const QList<quint64> connectionIds = m_networkManager->connectionIds();
+    if (connectionIds.isEmpty()) {
+        ui->statusbar->showMessage("Нет соединений для синхронизации");
+        return;
+    }
+    
+    for (quint64 connectionId : connectionIds) {
+        m_historySync->synchronize(connectionId);
+    }
+    ui->statusbar->showMessage("Синхронизация истории...");
+}
+
+/**
+ * Сообщает о завершении сверки истории с одним соединением
+ */
+void MainWindow::onSyncFinished(quint64 connectionId, int messagesReceived, int messagesSent, qint64 bytesTransferred)
+{
+    Q_UNUSED(connectionId);
+    ui->statusbar->showMessage(QString("Синхронизация завершена: получено %1, отправлено %2 сообщений, передано %3 байт")
+                               .arg(messagesReceived).arg(messagesSent).arg(bytesTransferred));
+}
+
+/**
+ * Сообщает о прерывании сверки: соединение закрыто или собеседник не отвечает
+ */
+void MainWindow::onSyncAborted(quint64 connectionId)
+{
+    Q_UNUSED(connectionId);
+    ui->statusbar->showMessage("Синхронизация прервана: соединение закрыто или собеседник не отвечает");
+}
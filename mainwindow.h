@@ -6,6 +6,7 @@
 #include <QInputDialog>
 #include "networkmanager.h"
 #include "databasemanager.h"
+#include "historysync.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -60,7 +61,7 @@ private slots:
      * Слот для обработки входящих сообщений
      * Отображает сообщение в чате и журналирует его в БД
      */
-    void onMessageReceived(const QString &message);
+    void onMessageReceived(const QString &message, const WireProtocol::MessageOrigin &origin);
     
     /*
      * Слот вызывается при успешном установлении соединения
@@ -82,9 +83,28 @@ private slots:
     
     /*
      * Слот для отображения истории сообщений из базы данных
-     * Создаёт диалоговое окно с таблицей всех сообщений
+     * Создаёт диалоговое окно с таблицей всех сообщений и поиском по тексту,
+     * сообщения загружаются в фоновых потоках
      */
     void onShowDatabase();
+    
+    /*
+     * Слот для сверки истории с собеседниками
+     * Запускает синхронизацию по всем установленным соединениям
+     */
+    void onSyncHistory();
+    
+    /*
+     * Слот вызывается по завершении сверки истории с одним соединением
+     * Показывает в статусной строке объем полученных и отправленных данных
+     */
+    void onSyncFinished(quint64 connectionId, int messagesReceived, int messagesSent, qint64 bytesTransferred);
+
+    /*
+     * Слот вызывается при прерывании сверки истории с одним соединением
+     * Показывает причину в статусной строке
+     */
+    void onSyncAborted(quint64 connectionId);
 
 private:
     // Указатель на UI-объекты, созданные в Qt Designer
@@ -96,6 +116,9 @@ private:
     // Объект для работы с базой данных сообщений
     DatabaseManager *m_databaseManager;
     
+    // Объект для сверки истории с другими экземплярами
+    HistorySync *m_historySync;
+    
     // Порт для серверной части приложения (по умолчанию 8080)
     int m_serverPort;
     
@@ -104,19 +127,40 @@ private:
     
     // Последний использованный порт для клиентского подключения
     int m_clientPort;
+    
+    // Файл для выгрузки трассы сообщений (пустой, если трассировка выключена)
+    QString m_tracePath;
 
     /*
      * Метод отображает сообщение в окне чата
      * Добавляет временную метку и направление сообщения (входящее/исходящее)
-     * Записывает сообщение в базу данных через m_databaseManager
+     * Записывает сообщение и его происхождение в базу данных через m_databaseManager
      */
-    void displayMessage(const QString &message, bool incoming);
+    void displayMessage(const QString &message, bool incoming, const WireProtocol::MessageOrigin &origin);
     
     /*
      * Метод обрабатывает аргументы командной строки для определения пути к БД
      * Ищет аргумент --db и открывает базу данных по указанному пути
      * При отсутствии аргумента использует базу данных по умолчанию "chat.db"
+     * Аргумент --partition day|month задает разбиение истории на разделы
      */
     void processDatabasePath();
+    
+    /*
+     * Метод обрабатывает аргументы командной строки для трассировки
+     * Аргумент --trace включает трассировку и задает файл для выгрузки,
+     * аргумент --trace-sample задает долю трассируемых сообщений
+     */
+    void processTraceOptions();
+    
+    /*
+     * Метод обрабатывает аргументы командной строки для сетевого транспорта
+     * Аргументы --tls-cert и --tls-key включают шифрование TLS,
+     * аргументы --tcp-* и --coalesce-ms настраивают сокеты и объединение записей,
+     * --ping-interval-ms и --idle-timeout-ms задают проверку активности соединений,
+     * --capture включает запись трафика в файл,
+     * --listen и --peer запускают сервер и подключают соседние ретрансляторы
+     */
+    void processNetworkOptions();
 };
 #endif // MAINWINDOW_H
@@ -1,4 +1,101 @@
 #include "networkmanager.h"
+#include "tracer.h"
+#include <QDateTime>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QtEndian>
+#include <utility>
+#ifdef CHAT_SHARED_TICKET_KEYS
+#include <openssl/ssl.h>
+#endif
+
+namespace {
+
+// Сколько идентификаторов сообщений помнить для подавления повторов
+const int SeenMessagesLimit = 100000;
+// Пауза перед повторным подключением к соседнему ретранслятору, мс
+const int PeerReconnectDelayMs = 1000;
+
+#ifdef CHAT_SHARED_TICKET_KEYS
+// Объект OpenSSL сокета; nullptr, если Qt использует другую библиотеку TLS
+SSL *openSslHandle(QSslSocket *socket)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 1, 0)
+    if (QSslSocket::activeBackend() != QLatin1String("openssl")) {
+        return nullptr;
+    }
+#endif
+    return static_cast<SSL*>(socket->sslHandle());
+}
+#endif
+
+} // namespace
+
+/**
+ * Принимает входящее подключение
+ * При включенном TLS создает QSslSocket и начинает серверное рукопожатие
+ * Qt создает отдельный контекст TLS для каждого сокета, поэтому до чтения
+ * ClientHello контексту задаются общие для сервера ключи билетов: билет,
+ * выданный одним соединением, принимается следующим
+ *
+ * @param socketDescriptor Дескриптор принятого сокета
+ */
+void TlsServer::incomingConnection(qintptr socketDescriptor)
+{
+    if (m_configuration.isNull()) {
+        QTcpServer::incomingConnection(socketDescriptor);
+        return;
+    }
+
+    QSslSocket *socket = new QSslSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+
+    socket->setSslConfiguration(m_configuration);
+    addPendingConnection(socket);
+    socket->startServerEncryption();
+    // ClientHello будет прочитан только в цикле событий
+    shareTicketKeys(socket);
+}
+
+/**
+ * Задает контексту TLS сокета ключи билетов сессий, общие для всех подключений
+ * Ключи создаются при первом подключении и живут, пока существует сервер
+ *
+ * @param socket Сокет, начавший серверное рукопожатие
+ */
+void TlsServer::shareTicketKeys(QSslSocket *socket)
+{
+#ifdef CHAT_SHARED_TICKET_KEYS
+    SSL *ssl = openSslHandle(socket);
+    if (!ssl) {
+        return;
+    }
+
+    // Размер ключей зависит от версии OpenSSL: 48 байт в 1.0, 80 байт начиная с 1.1
+    SSL_CTX *context = SSL_get_SSL_CTX(ssl);
+    const long size = SSL_CTX_get_tlsext_ticket_keys(context, nullptr, 0);
+    if (size <= 0) {
+        return;
+    }
+    if (m_ticketKeys.size() != size) {
+        m_ticketKeys.resize(size);
+        QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(m_ticketKeys.data()),
+                                              size / sizeof(quint32));
+    }
+    SSL_CTX_set_tlsext_ticket_keys(context, m_ticketKeys.data(), size);
+
+    // Сессия возобновляется только в том же контексте идентификатора
+    static const unsigned char SessionContext[] = "PR_2_chat";
+    SSL_set_session_id_context(ssl, SessionContext, sizeof(SessionContext) - 1);
+#else
+    Q_UNUSED(socket);
+#endif
+}
 
 /**
  * Конструктор класса NetworkManager
@@ -8,15 +105,33 @@
 NetworkManager::NetworkManager(QObject *parent)
     : QObject(parent)
     , m_server(nullptr)
-    , m_clientSocket(nullptr)
     , m_socket(nullptr)
     , m_isConnected(false)
+    , m_flushTimer(nullptr)
+    , m_lastQueueNs(0)
+    , m_averageIntervalNs(0)
+    , m_nextConnectionId(1)
+    , m_heartbeatWheel(nullptr)
+    , m_nodeId(QRandomGenerator::global()->generate64())
+    , m_sequence(0)
+    , m_relayEnabled(false)
 {
     // Создаем экземпляр TCP-сервера
-    m_server = new QTcpServer(this);
+    m_server = new TlsServer(this);
     
     // Подключаем сигнал о новом соединении к соответствующему слоту
     connect(m_server, &QTcpServer::newConnection, this, &NetworkManager::onNewConnection);
+    
+    // Таймер отправки накопленных кадров: срабатывает после текущей итерации цикла событий
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_flushTimer, &QTimer::timeout, this, &NetworkManager::flushPendingWrites);
+    m_clock.start();
+    
+    // Одно колесо таймеров на все соединения вместо отдельного QTimer на сокет
+    m_heartbeatWheel = new TimerWheel(100, 1024, this);
+    connect(m_heartbeatWheel, &TimerWheel::expired, this, &NetworkManager::onHeartbeatExpired);
 }
 
 /**
@@ -60,43 +175,274 @@ bool NetworkManager::connectToServer(const QString &address, int port)
         // Отключаемся от хоста
         m_socket->disconnectFromHost();
         // Освобождаем ресурсы
+        detachSocket(m_socket);
         delete m_socket;
     }
     
-    // Создаем новый сокет для подключения к серверу
-    m_socket = new QTcpSocket(this);
+    // Без TLS создаем обычный сокет для подключения к серверу
+    if (!isTlsEnabled()) {
+        m_socket = new QTcpSocket(this);
+        
+        // Связываем сигналы сокета с нашими слотами
+        connect(m_socket, &QTcpSocket::connected, this, &NetworkManager::onConnected);
+        connect(m_socket, &QTcpSocket::disconnected, this, &NetworkManager::disconnected);
+        attachSocket(m_socket);
+        connect(m_socket, &QTcpSocket::errorOccurred, this, &NetworkManager::onSocketError);
+        
+        // Пытаемся установить соединение с сервером
+        m_socket->connectToHost(address, port);
+        return true;
+    }
+    
+    // С TLS подключение считается установленным только после рукопожатия
+    QSslSocket *sslSocket = new QSslSocket(this);
+    m_socket = sslSocket;
+    m_peerKey = address + ":" + QString::number(port);
+    
+    // Предъявляем сохраненный билет сессии: сервер с общими ключами билетов
+    // (в том числе встроенный TlsServer) пропустит полное рукопожатие
+    QSslConfiguration configuration = m_tlsConfiguration;
+    configuration.setSessionTicket(m_sessionTickets.value(m_peerKey));
+    sslSocket->setSslConfiguration(configuration);
+    
+    connect(sslSocket, &QSslSocket::encrypted, this, &NetworkManager::onConnected);
+    connect(sslSocket, &QSslSocket::encrypted, this, &NetworkManager::onSessionTicketReceived);
+    connect(sslSocket, &QSslSocket::newSessionTicketReceived, this, &NetworkManager::onSessionTicketReceived);
+    connect(sslSocket, QOverload<const QList<QSslError> &>::of(&QSslSocket::sslErrors),
+            this, &NetworkManager::onSslErrors);
+    connect(sslSocket, &QTcpSocket::disconnected, this, &NetworkManager::disconnected);
+    attachSocket(sslSocket);
+    connect(sslSocket, &QTcpSocket::errorOccurred, this, &NetworkManager::onSocketError);
+    
+    sslSocket->connectToHostEncrypted(address, port);
+    return true;
+}
+
+/**
+ * Включает шифрование TLS для сервера и исходящих подключений
+ * Сертификат одновременно добавляется в доверенные, поэтому экземпляры
+ * с одним самоподписанным сертификатом могут проверять друг друга.
+ * Для подключения по IP-адресу сертификат должен содержать его в subjectAltName:
+ * openssl req -x509 -newkey rsa:2048 -nodes -keyout key.pem -out cert.pem -days 365
+ *     -subj /CN=localhost -addext subjectAltName=DNS:localhost,IP:127.0.0.1
+ * 
+ * @param certificatePath Путь к сертификату в формате PEM
+ * @param keyPath Путь к закрытому ключу RSA или EC в формате PEM
+ * @return true, если сертификат и ключ успешно загружены
+ */
+bool NetworkManager::setTlsCredentials(const QString &certificatePath, const QString &keyPath)
+{
+    QFile certificateFile(certificatePath);
+    QFile keyFile(keyPath);
+    if (!certificateFile.open(QIODevice::ReadOnly) || !keyFile.open(QIODevice::ReadOnly)) {
+        emit error("Невозможно прочитать сертификат или ключ TLS");
+        return false;
+    }
+    
+    QSslCertificate certificate(&certificateFile, QSsl::Pem);
+    const QByteArray keyData = keyFile.readAll();
+    QSslKey key(keyData, QSsl::Rsa, QSsl::Pem);
+    if (key.isNull()) {
+        key = QSslKey(keyData, QSsl::Ec, QSsl::Pem);
+    }
+    
+    if (certificate.isNull() || key.isNull()) {
+        emit error("Некорректный сертификат или ключ TLS");
+        return false;
+    }
     
-    // Связываем сигналы сокета с нашими слотами
-    connect(m_socket, &QTcpSocket::connected, this, &NetworkManager::onConnected);
-    connect(m_socket, &QTcpSocket::disconnected, this, &NetworkManager::disconnected);
-    connect(m_socket, &QTcpSocket::readyRead, this, &NetworkManager::onReadyRead);
-    connect(m_socket, &QTcpSocket::errorOccurred, this, &NetworkManager::onSocketError);
+    QSslConfiguration configuration = QSslConfiguration::defaultConfiguration();
+    configuration.setLocalCertificate(certificate);
+    configuration.setPrivateKey(key);
+    configuration.setCaCertificates(configuration.caCertificates() << certificate);
+    // Разрешаем сохранять сессию, иначе билет для возобновления недоступен
+    configuration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    m_tlsConfiguration = configuration;
     
-    // Пытаемся установить соединение с сервером
-    m_socket->connectToHost(address, port);
+    // Сервер не требует сертификат от клиентов
+    QSslConfiguration serverConfiguration = configuration;
+    serverConfiguration.setPeerVerifyMode(QSslSocket::VerifyNone);
+    m_server->setSslConfiguration(serverConfiguration);
     return true;
 }
 
+bool NetworkManager::isTlsEnabled() const
+{
+    return !m_tlsConfiguration.isNull();
+}
+
+quint16 NetworkManager::serverPort() const
+{
+    return m_server->serverPort();
+}
+
 /**
  * Отправляет текстовое сообщение через активные соединения
- * Если активны оба соединения (клиентское и серверное),
- * сообщение отправляется через оба
+ * Если активны и входящие, и исходящее соединения,
+ * сообщение отправляется через все
+ * Если текущая трасса выбрана для трассировки, ее контекст передается в кадре
  * 
  * @param message Текст сообщения для отправки
  */
-void NetworkManager::sendMessage(const QString &message)
+WireProtocol::MessageOrigin NetworkManager::sendMessage(const QString &message)
+{
+    TraceSpan span("net.send");
+    span.setFlow(Tracer::FlowOut);
+
+    // Упаковываем текст в кодировке UTF-8 в кадр сообщения
+    WireProtocol::Frame frame;
+    frame.type = WireProtocol::MessageFrame;
+    frame.body = message.toUtf8();
+
+    const Tracer::Context context = span.context();
+    if (context.isValid()) {
+        frame.flags |= WireProtocol::HasTraceContext;
+        frame.traceId = context.traceId;
+        frame.parentSpanId = context.spanId;
+    }
+
+    // Сообщение появилось на этом узле: назначаем ему идентификатор
+    frame.flags |= WireProtocol::HasMessageId;
+    frame.originId = m_nodeId;
+    frame.sequence = ++m_sequence;
+    frame.originTimeMs = QDateTime::currentMSecsSinceEpoch();
+    markSeen(frame.originId, frame.sequence);
+
+    QByteArray data = WireProtocol::encode(frame);
+    
+    // Отправляем через все активные соединения: клиентов нашего сервера и сервер, к которому подключены
+    for (auto it = m_connections.cbegin(); it != m_connections.cend(); ++it) {
+        if (it.key()->state() == QTcpSocket::ConnectedState) {
+            queueFrame(it.key(), data);
+        }
+    }
+
+    WireProtocol::MessageOrigin origin;
+    origin.nodeId = frame.originId;
+    origin.sequence = frame.sequence;
+    origin.timeMs = frame.originTimeMs;
+    return origin;
+}
+
+/**
+ * Ставит кадр в очередь отправки соединения
+ * Кадры, поставленные за одну итерацию цикла событий, уходят одним вызовом write.
+ * Одиночное сообщение отправляется сразу после текущей итерации, а при плотном
+ * потоке отправка откладывается не более чем на maxCoalesceDelayMs
+ * 
+ * @param socket Сокет соединения
+ * @param data Закодированный кадр
+ */
+void NetworkManager::queueFrame(QTcpSocket *socket, const QByteArray &data)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) return;
+    
+    it->writeBuffer.append(data);
+    ++m_stats.framesSent;
+    m_capture.write(TrafficCapture::OutboundFrame, quint32(it->id), data);
+    
+    // Сглаживаем интервал между кадрами, чтобы отличить поток от одиночных сообщений;
+    // кадры, отправленные сразу по объему, тоже входят в поток
+    const qint64 nowNs = m_clock.nsecsElapsed();
+    const qint64 intervalNs = nowNs - m_lastQueueNs;
+    m_lastQueueNs = nowNs;
+    m_averageIntervalNs = m_averageIntervalNs ? (m_averageIntervalNs * 7 + intervalNs) / 8 : intervalNs;
+    
+    // Большой объем отправляем сразу, не дожидаясь таймера
+    if (it->writeBuffer.size() >= m_socketOptions.flushThresholdBytes) {
+        // Соединение больше не ждет таймера; иначе оно попало бы в очередь повторно
+        if (it->flushScheduled) {
+            m_pendingSockets.removeOne(socket);
+        }
+        flushSocket(socket, *it);
+        return;
+    }
+    
+    if (!it->flushScheduled) {
+        it->flushScheduled = true;
+        m_pendingSockets.append(socket);
+    }
+    
+    if (m_flushTimer->isActive()) return;
+    
+    // Если кадры идут чаще допустимой задержки, ждем следующих, иначе отправляем сразу
+    const qint64 maxDelayNs = qint64(m_socketOptions.maxCoalesceDelayMs) * 1000000;
+    m_flushTimer->start(m_averageIntervalNs < maxDelayNs ? m_socketOptions.maxCoalesceDelayMs : 0);
+}
+
+/**
+ * Записывает все накопленные кадры соединения в сокет одним вызовом
+ * 
+ * @param socket Сокет соединения
+ * @param connection Состояние соединения
+ */
+void NetworkManager::flushSocket(QTcpSocket *socket, Connection &connection)
+{
+    connection.flushScheduled = false;
+    if (connection.writeBuffer.isEmpty()) return;
+    
+    socket->write(connection.writeBuffer);
+    ++m_stats.writeCalls;
+    m_stats.bytesSent += quint64(connection.writeBuffer.size());
+    connection.writeBuffer.clear();
+}
+
+/**
+ * Отправляет накопленные кадры всех соединений
+ * Вызывается таймером отложенной отправки и перед закрытием соединений
+ */
+void NetworkManager::flushPendingWrites()
 {
-    // Преобразуем текстовое сообщение в массив байтов в кодировке UTF-8
-    QByteArray data = message.toUtf8();
+    const QVector<QTcpSocket*> sockets = m_pendingSockets;
+    m_pendingSockets.clear();
     
-    // Если есть активное клиентское соединение, отправляем через него
-    if (m_clientSocket && m_clientSocket->state() == QTcpSocket::ConnectedState) {
-        m_clientSocket->write(data);
+    for (QTcpSocket *socket : sockets) {
+        // Сокет мог быть закрыт, пока кадры ждали отправки
+        auto it = m_connections.find(socket);
+        if (it != m_connections.end()) {
+            flushSocket(socket, *it);
+        }
     }
+}
+
+/**
+ * Задает параметры сокетов для последующих соединений
+ * 
+ * @param options Параметры сокетов и объединения записей
+ */
+void NetworkManager::setSocketOptions(const SocketOptions &options)
+{
+    m_socketOptions = options;
+}
+
+NetworkManager::SocketOptions NetworkManager::socketOptions() const
+{
+    return m_socketOptions;
+}
+
+NetworkManager::Stats NetworkManager::stats() const
+{
+    return m_stats;
+}
+
+/**
+ * Применяет параметры к сокету
+ * Параметры действуют только для открытого сокета, поэтому для исходящих
+ * подключений вызывается после установления соединения
+ * 
+ * @param socket Сокет соединения
+ */
+void NetworkManager::applySocketOptions(QTcpSocket *socket)
+{
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, m_socketOptions.lowDelay ? 1 : 0);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, m_socketOptions.keepAlive ? 1 : 0);
     
-    // Если есть активное соединение с сервером, отправляем через него
-    if (m_socket && m_socket->state() == QTcpSocket::ConnectedState) {
-        m_socket->write(data);
+    if (m_socketOptions.sendBufferSize > 0) {
+        socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, m_socketOptions.sendBufferSize);
+    }
+    if (m_socketOptions.receiveBufferSize > 0) {
+        socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, m_socketOptions.receiveBufferSize);
     }
 }
 
@@ -106,24 +452,26 @@ void NetworkManager::sendMessage(const QString &message)
  */
 void NetworkManager::closeConnections()
 {
+    // Отправляем кадры, еще ожидающие в очереди
+    m_flushTimer->stop();
+    flushPendingWrites();
+    
     // Останавливаем сервер, если он запущен
     if (m_server) {
         m_server->close();
     }
     
-    // Закрываем соединение с клиентом, если оно установлено
-    if (m_clientSocket) {
-        m_clientSocket->disconnectFromHost();
-        m_clientSocket->deleteLater();
-        m_clientSocket = nullptr;
-    }
+    // Забываем соседние ретрансляторы, чтобы не переподключаться к ним
+    m_peerLinks.clear();
     
-    // Закрываем соединение с сервером, если оно установлено
-    if (m_socket) {
-        m_socket->disconnectFromHost();
-        m_socket->deleteLater();
-        m_socket = nullptr;
+    // Закрываем соединения с клиентами и с сервером, если они установлены
+    const QList<QTcpSocket*> sockets = m_connections.keys();
+    for (QTcpSocket *socket : sockets) {
+        detachSocket(socket);
+        socket->disconnectFromHost();
+        socket->deleteLater();
     }
+    m_socket = nullptr;
     
     // Обновляем флаг состояния подключения
     m_isConnected = false;
@@ -132,22 +480,15 @@ void NetworkManager::closeConnections()
 /**
  * Обработчик сигнала о новом входящем подключении
  * Вызывается, когда к нашему серверу подключается клиент
+ * Сервер одновременно обслуживает любое число клиентов
  */
 void NetworkManager::onNewConnection()
 {
-    // Если у нас уже есть клиентское подключение, закрываем его
-    if (m_clientSocket) {
-        m_clientSocket->disconnectFromHost();
-        m_clientSocket->deleteLater();
-    }
-    
-    // Получаем сокет нового подключения
-    m_clientSocket = m_server->nextPendingConnection();
-    
-    if (m_clientSocket) {
+    // Получаем сокеты всех ожидающих подключений
+    while (QTcpSocket *clientSocket = m_server->nextPendingConnection()) {
         // Связываем сигналы нового сокета с нашими слотами
-        connect(m_clientSocket, &QTcpSocket::readyRead, this, &NetworkManager::onReadyRead);
-        connect(m_clientSocket, &QTcpSocket::disconnected, this, &NetworkManager::onClientDisconnected);
+        attachSocket(clientSocket);
+        connect(clientSocket, &QTcpSocket::disconnected, this, &NetworkManager::onClientDisconnected);
         
         // Устанавливаем флаг подключения и отправляем сигнал о подключении
         m_isConnected = true;
@@ -155,24 +496,216 @@ void NetworkManager::onNewConnection()
     }
 }
 
+/**
+ * Регистрирует сокет как активное соединение
+ * Создает для него буфер разбора кадров и подключает сигнал чтения
+ *
+ * @param socket Сокет нового соединения
+ */
+void NetworkManager::attachSocket(QTcpSocket *socket)
+{
+    Connection connection;
+    connection.id = m_nextConnectionId++;
+    connection.lastActivityMs = m_clock.elapsed();
+    m_connections.insert(socket, connection);
+    m_socketsById.insert(connection.id, socket);
+    m_capture.write(TrafficCapture::ConnectionOpened, quint32(connection.id));
+    connect(socket, &QTcpSocket::readyRead, this, &NetworkManager::onReadyRead);
+    
+    // Первая проверка активности через интервал ping
+    if (m_socketOptions.pingIntervalMs > 0) {
+        m_heartbeatWheel->schedule(connection.id, m_socketOptions.pingIntervalMs);
+    }
+    
+    // Параметры сокета применяются к установленному соединению
+    if (socket->state() == QAbstractSocket::ConnectedState) {
+        applySocketOptions(socket);
+    } else {
+        connect(socket, &QTcpSocket::connected, this, [this, socket]() {
+            applySocketOptions(socket);
+        });
+    }
+}
+
+/**
+ * Забывает состояние соединения перед удалением сокета
+ *
+ * @param socket Сокет закрываемого соединения
+ */
+void NetworkManager::detachSocket(QTcpSocket *socket)
+{
+    // Срок в колесе таймеров остается и будет отброшен при срабатывании
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) return;
+    
+    m_capture.write(TrafficCapture::ConnectionClosed, quint32(it->id));
+    
+    // Встречное соединение соседа, заменявшее наше, потеряно: подключаемся сами
+    if (it->isPeer && !it->dialed && it->peerNodeId != 0) {
+        for (int i = 0; i < m_peerLinks.size(); ++i) {
+            if (m_peerLinks.at(i).replacedBy == it->peerNodeId) {
+                m_peerLinks[i].replacedBy = 0;
+                schedulePeerReconnect(i);
+            }
+        }
+    }
+    
+    const quint64 connectionId = it->id;
+    m_socketsById.remove(connectionId);
+    m_connections.erase(it);
+    emit connectionClosed(connectionId);
+}
+
 /**
  * Обработчик получения данных по сети
  * Вызывается, когда в сокете появляются данные для чтения
+ * Данные накапливаются в буфере соединения и разбираются на целые кадры
  */
 void NetworkManager::onReadyRead()
 {
     // Определяем, от какого сокета пришли данные
     QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
     if (!socket) return;
+
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) return;
     
-    // Читаем все доступные данные из сокета
-    QByteArray data = socket->readAll();
+    // Дописываем все доступные данные в буфер соединения
+    const QByteArray data = socket->readAll();
+    m_stats.bytesReceived += quint64(data.size());
+    it->readBuffer.append(data);
+    
+    // Любые данные от собеседника подтверждают, что соединение живо
+    it->lastActivityMs = m_clock.elapsed();
+    it->pingOutstanding = false;
+    const quint32 connectionId = quint32(it->id);
+    QByteArray buffer = it->readBuffer;
+    it->readBuffer.clear();
+
+    // Разбираем все целые кадры, накопленные в буфере
+    int offset = 0;
+    WireProtocol::Frame frame;
+    forever {
+        const int frameStart = offset;
+        const quint64 decodeStartUs = Tracer::isEnabled() ? Tracer::nowMicros() : 0;
+        const WireProtocol::DecodeResult result = WireProtocol::decode(buffer, offset, frame);
+        if (result == WireProtocol::Incomplete) {
+            break;
+        }
+        if (result == WireProtocol::Malformed) {
+            // Поток рассинхронизирован, продолжать чтение бессмысленно
+            emit error("Ошибка сети: получены некорректные данные");
+            socket->abort();
+            return;
+        }
+
+        const quint64 decodeEndUs = Tracer::isEnabled() ? Tracer::nowMicros() : 0;
+        ++m_stats.framesReceived;
+        if (m_capture.isOpen()) {
+            m_capture.write(TrafficCapture::InboundFrame, connectionId, buffer.mid(frameStart, offset - frameStart));
+        }
+        handleFrame(socket, frame, decodeStartUs, decodeEndUs);
+
+        // Обработчик сообщения мог закрыть соединение
+        if (!m_connections.contains(socket)) {
+            return;
+        }
+    }
+
+    // Сохраняем неполный хвост до прихода следующей порции данных
+    m_connections[socket].readBuffer = buffer.mid(offset);
+}
+
+/**
+ * Обрабатывает разобранный кадр
+ * Продолжает трассу отправителя, если контекст передан в кадре,
+ * иначе сам решает, выбирать ли сообщение для трассировки
+ *
+ * Отвечает на ping; pong лишь отмечает активность, что уже сделано при чтении
+ *
+ * @param socket Сокет, из которого получен кадр
+ * @param frame Разобранный кадр
+ * @param decodeStartUs Время начала разбора кадра
+ * @param decodeEndUs Время окончания разбора кадра
+ */
+void NetworkManager::handleFrame(QTcpSocket *socket, const WireProtocol::Frame &frame,
+                                 quint64 decodeStartUs, quint64 decodeEndUs)
+{
+    if (frame.type == WireProtocol::PingFrame) {
+        sendControlFrame(socket, WireProtocol::PongFrame);
+        return;
+    }
+    if (frame.type == WireProtocol::HelloFrame) {
+        // Соединение с самим собой (например, через общий адрес) не нужно
+        const quint64 peerNodeId = frame.body.size() == sizeof(quint64)
+                ? qFromBigEndian<quint64>(frame.body.constData()) : 0;
+        if (peerNodeId == m_nodeId) {
+            socket->abort();
+            return;
+        }
+        Connection &connection = m_connections[socket];
+        connection.isPeer = true;
+        connection.peerNodeId = peerNodeId;
+        
+        // Подключившийся к нам сосед должен узнать наш идентификатор,
+        // чтобы обе стороны одинаково выбрали лишнее соединение
+        if (!connection.dialed) {
+            sendHello(socket);
+        }
+        dropDuplicatePeerLink(socket);
+        return;
+    }
+    if (frame.type == WireProtocol::SyncFrame) {
+        // Содержимое сверки истории разбирает ее обработчик
+        emit syncFrameReceived(m_connections.constFind(socket)->id, frame.body);
+        return;
+    }
+    if (frame.type != WireProtocol::MessageFrame) {
+        return;
+    }
+    
+    // Сообщению клиента без идентификатора назначаем его от имени этого узла
+    WireProtocol::Frame message = frame;
+    if (!(message.flags & WireProtocol::HasMessageId)) {
+        message.flags |= WireProtocol::HasMessageId;
+        message.originId = m_nodeId;
+        message.sequence = ++m_sequence;
+        message.originTimeMs = QDateTime::currentMSecsSinceEpoch();
+    }
+    
+    // Сообщение, пришедшее повторно по другому пути, отбрасываем
+    if (!markSeen(message.originId, message.sequence)) {
+        ++m_stats.duplicatesDropped;
+        return;
+    }
+
+    Tracer::Context parent;
+    if (frame.flags & WireProtocol::HasTraceContext) {
+        parent.traceId = frame.traceId;
+        parent.spanId = frame.parentSpanId;
+    } else {
+        parent = Tracer::startTrace();
+    }
+
+    TraceSpan span("net.receive", parent, decodeStartUs);
+    span.setFlow(Tracer::FlowIn);
+    Tracer::recordSpan("net.decode", span.context(), decodeStartUs, decodeEndUs);
     
+    // Пересылаем до показа и журналирования, чтобы не задерживать другие узлы
+    if (m_relayEnabled) {
+        relayMessage(socket, message, span.context());
+    }
+
     // Преобразуем данные из UTF-8 в строку QString
-    QString message = QString::fromUtf8(data);
+    QString text = QString::fromUtf8(frame.body);
+
+    WireProtocol::MessageOrigin origin;
+    origin.nodeId = message.originId;
+    origin.sequence = message.sequence;
+    origin.timeMs = message.originTimeMs;
     
     // Отправляем сигнал с полученным сообщением
-    emit messageReceived(message);
+    emit messageReceived(text, origin);
 }
 
 /**
@@ -184,14 +717,14 @@ void NetworkManager::onClientDisconnected()
     // Определяем, какой сокет был отключен
     QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
     
-    // Если это клиентский сокет, выполняем очистку
-    if (socket == m_clientSocket) {
+    // Если это известный клиентский сокет, выполняем очистку
+    if (socket && m_connections.contains(socket)) {
         // Запланируем удаление сокета
-        m_clientSocket->deleteLater();
-        m_clientSocket = nullptr;
+        detachSocket(socket);
+        socket->deleteLater();
         
-        // Сбрасываем флаг подключения и отправляем сигнал об отключении
-        m_isConnected = false;
+        // Обновляем флаг подключения и отправляем сигнал об отключении
+        m_isConnected = !m_connections.isEmpty();
         emit disconnected();
     }
 }
@@ -205,6 +738,15 @@ void NetworkManager::onConnected()
     // Устанавливаем флаг подключения
     m_isConnected = true;
     
+#ifdef CHAT_SHARED_TICKET_KEYS
+    // Сервер принял предъявленный билет и пропустил полное рукопожатие
+    QSslSocket *sslSocket = qobject_cast<QSslSocket*>(sender());
+    SSL *ssl = sslSocket ? openSslHandle(sslSocket) : nullptr;
+    if (ssl && SSL_session_reused(ssl)) {
+        ++m_stats.sessionsResumed;
+    }
+#endif
+    
     // Отправляем сигнал об успешном подключении
     emit connected();
 }
@@ -223,3 +765,376 @@ void NetworkManager::onSocketError(QAbstractSocket::SocketError socketError)
     // Отправляем сигнал с описанием ошибки
     emit error("Ошибка сети: " + socket->errorString());
 }
+
+/**
+ * Сохраняет билет сессии TLS текущего подключения для следующего подключения к тому же серверу
+ * При TLS 1.3 билет приходит уже после рукопожатия отдельным сообщением,
+ * поэтому обработчик вызывается и по сигналу encrypted, и по newSessionTicketReceived
+ */
+void NetworkManager::onSessionTicketReceived()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket || m_peerKey.isEmpty()) return;
+    
+    const QByteArray ticket = socket->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        m_sessionTickets.insert(m_peerKey, ticket);
+    }
+}
+
+/**
+ * Обработчик ошибок проверки сертификата сервера
+ * Ошибки не игнорируются: рукопожатие прерывается, а пользователь получает описание
+ * 
+ * @param errors Список ошибок проверки
+ */
+void NetworkManager::onSslErrors(const QList<QSslError> &errors)
+{
+    QStringList descriptions;
+    for (const QSslError &sslError : errors) {
+        descriptions.append(sslError.errorString());
+    }
+    
+    // Устаревший билет мог стать причиной ошибки, поэтому забываем его
+    m_sessionTickets.remove(m_peerKey);
+    emit error("Ошибка TLS: " + descriptions.join("; "));
+}
+
+int NetworkManager::connectionCount() const
+{
+    return m_connections.size();
+}
+
+/**
+ * Начинает запись трафика в файл
+ * Уже открытые соединения попадают в запись как только что открытые,
+ * чтобы при воспроизведении их кадры было к чему привязать
+ * 
+ * @param path Путь к файлу записи
+ * @return true, если запись начата
+ */
+bool NetworkManager::startCapture(const QString &path)
+{
+    if (!m_capture.open(path)) {
+        emit error("Невозможно начать запись трафика: " + path);
+        return false;
+    }
+    
+    for (const Connection &connection : std::as_const(m_connections)) {
+        m_capture.write(TrafficCapture::ConnectionOpened, quint32(connection.id));
+    }
+    return true;
+}
+
+void NetworkManager::stopCapture()
+{
+    m_capture.close();
+}
+
+/**
+ * Отправляет служебный кадр без тела
+ * 
+ * @param socket Сокет соединения
+ * @param type Тип кадра
+ */
+void NetworkManager::sendControlFrame(QTcpSocket *socket, WireProtocol::FrameType type)
+{
+    WireProtocol::Frame frame;
+    frame.type = type;
+    queueFrame(socket, WireProtocol::encode(frame));
+}
+
+/**
+ * Проверяет активность соединения, когда истекает его срок в колесе таймеров
+ * Активность отмечается при чтении без перестановки срока, поэтому здесь
+ * срок лишь переносится на оставшееся время. Молчащему соединению
+ * отправляется ping, а не ответившее до таймаута бездействия закрывается
+ * 
+ * @param connectionId Идентификатор соединения
+ */
+void NetworkManager::onHeartbeatExpired(quint64 connectionId)
+{
+    // Соединение могло закрыться после постановки срока
+    QTcpSocket *socket = m_socketsById.value(connectionId);
+    if (!socket) return;
+    
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) return;
+    
+    // Отключенный сокет уже сообщил о разрыве, проверять его незачем
+    if (socket->state() == QAbstractSocket::UnconnectedState) return;
+    
+    const int pingIntervalMs = m_socketOptions.pingIntervalMs;
+    const int idleTimeoutMs = qMax(m_socketOptions.idleTimeoutMs, pingIntervalMs);
+    if (pingIntervalMs <= 0) return;
+    
+    const qint64 idleMs = m_clock.elapsed() - it->lastActivityMs;
+    if (idleMs >= idleTimeoutMs) {
+        reapConnection(socket);
+        return;
+    }
+    
+    if (idleMs >= pingIntervalMs) {
+        if (!it->pingOutstanding) {
+            it->pingOutstanding = true;
+            ++m_stats.pingsSent;
+            sendControlFrame(socket, WireProtocol::PingFrame);
+        }
+        m_heartbeatWheel->schedule(connectionId, int(idleTimeoutMs - idleMs));
+    } else {
+        m_heartbeatWheel->schedule(connectionId, int(pingIntervalMs - idleMs));
+    }
+}
+
+/**
+ * Закрывает соединение, не ответившее на ping до таймаута бездействия
+ * Освобождает его буферы и сообщает о разрыве через сигнал disconnected
+ * 
+ * @param socket Сокет соединения
+ */
+void NetworkManager::reapConnection(QTcpSocket *socket)
+{
+    detachSocket(socket);
+    ++m_stats.connectionsReaped;
+    
+    // Отключаем наши обработчики, чтобы о разрыве сообщить ровно один раз
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+    
+    if (socket == m_socket) {
+        m_socket = nullptr;
+    }
+    
+    // Соединение с соседним ретранслятором будет восстановлено
+    onPeerLinkLost(socket);
+    
+    m_isConnected = !m_connections.isEmpty();
+    emit disconnected();
+}
+
+void NetworkManager::setRelayEnabled(bool enabled)
+{
+    m_relayEnabled = enabled;
+}
+
+bool NetworkManager::isRelayEnabled() const
+{
+    return m_relayEnabled;
+}
+
+quint64 NetworkManager::nodeId() const
+{
+    return m_nodeId;
+}
+
+QList<quint64> NetworkManager::connectionIds() const
+{
+    QList<quint64> ids;
+    for (auto it = m_connections.cbegin(); it != m_connections.cend(); ++it) {
+        if (it.key()->state() == QTcpSocket::ConnectedState) {
+            ids.append(it->id);
+        }
+    }
+    return ids;
+}
+
+/**
+ * Отправляет кадр сверки истории в конкретное соединение
+ * Кадр проходит через ту же очередь, что и сообщения, поэтому объединяется с ними
+ *
+ * @param connectionId Идентификатор соединения
+ * @param body Тело кадра, сформированное HistorySync
+ * @return true, если кадр поставлен в очередь отправки
+ */
+bool NetworkManager::sendSyncFrame(quint64 connectionId, const QByteArray &body)
+{
+    QTcpSocket *socket = m_socketsById.value(connectionId);
+    if (!socket || socket->state() != QTcpSocket::ConnectedState) {
+        return false;
+    }
+
+    WireProtocol::Frame frame;
+    frame.type = WireProtocol::SyncFrame;
+    frame.body = body;
+    queueFrame(socket, WireProtocol::encode(frame));
+    return true;
+}
+
+/**
+ * Добавляет соседний ретранслятор и подключается к нему
+ * Для каждой пары узлов достаточно одного соединения: сообщения по нему идут в обе стороны
+ * 
+ * @param address Адрес соседнего ретранслятора
+ * @param port Порт соседнего ретранслятора
+ */
+void NetworkManager::addRelayPeer(const QString &address, int port)
+{
+    PeerLink link;
+    link.address = address;
+    link.port = port;
+    m_peerLinks.append(link);
+    
+    m_relayEnabled = true;
+    connectPeerLink(m_peerLinks.size() - 1);
+}
+
+/**
+ * Подключается к соседнему ретранслятору и представляется ему кадром Hello,
+ * чтобы тот отличал соединение от клиентского
+ * 
+ * @param index Индекс ретранслятора в m_peerLinks
+ */
+void NetworkManager::connectPeerLink(int index)
+{
+    PeerLink &link = m_peerLinks[index];
+    QTcpSocket *socket = isTlsEnabled() ? new QSslSocket(this) : new QTcpSocket(this);
+    link.socket = socket;
+    
+    attachSocket(socket);
+    m_connections[socket].isPeer = true;
+    m_connections[socket].dialed = true;
+    
+    // Кадр Hello, записанный до окончания рукопожатия TLS, сокет отправит после него
+    connect(socket, &QTcpSocket::connected, this, [this, socket]() { sendHello(socket); });
+    connect(socket, &QTcpSocket::disconnected, this, [this, socket]() { onPeerLinkLost(socket); });
+    connect(socket, &QTcpSocket::errorOccurred, this, [this, socket]() { onPeerLinkLost(socket); });
+    
+    if (QSslSocket *sslSocket = qobject_cast<QSslSocket*>(socket)) {
+        sslSocket->setSslConfiguration(m_tlsConfiguration);
+        sslSocket->connectToHostEncrypted(link.address, link.port);
+    } else {
+        socket->connectToHost(link.address, link.port);
+    }
+}
+
+/**
+ * Освобождает сокет потерянного соседнего ретранслятора и планирует переподключение
+ * 
+ * @param socket Сокет соединения
+ */
+void NetworkManager::onPeerLinkLost(QTcpSocket *socket)
+{
+    int index = -1;
+    for (int i = 0; i < m_peerLinks.size(); ++i) {
+        if (m_peerLinks.at(i).socket == socket) {
+            index = i;
+            break;
+        }
+    }
+    // Сигналы disconnected и errorOccurred могут прийти оба, обрабатываем первый
+    if (index < 0) return;
+    
+    m_peerLinks[index].socket = nullptr;
+    detachSocket(socket);
+    socket->disconnect(this);
+    socket->deleteLater();
+    
+    // Соединение, закрытое как лишнее, не восстанавливаем: сосед подключен к нам сам
+    if (m_peerLinks.at(index).replacedBy == 0) {
+        schedulePeerReconnect(index);
+    }
+}
+
+void NetworkManager::schedulePeerReconnect(int index)
+{
+    QTimer::singleShot(PeerReconnectDelayMs, this, [this, index]() {
+        // Список ретрансляторов мог быть очищен при закрытии соединений
+        if (index < m_peerLinks.size() && !m_peerLinks.at(index).socket
+            && m_peerLinks.at(index).replacedBy == 0) {
+            connectPeerLink(index);
+        }
+    });
+}
+
+void NetworkManager::sendHello(QTcpSocket *socket)
+{
+    WireProtocol::Frame frame;
+    frame.type = WireProtocol::HelloFrame;
+    frame.body.resize(sizeof(quint64));
+    qToBigEndian<quint64>(m_nodeId, frame.body.data());
+    queueFrame(socket, WireProtocol::encode(frame));
+}
+
+/**
+ * Оставляет одно соединение между двумя узлами, указавшими друг друга соседями
+ * Иначе каждое сообщение проходило бы между ними дважды и отбрасывалось бы
+ * только по идентификатору. Обе стороны оставляют соединение, установленное
+ * узлом с меньшим идентификатором, поэтому закрывают одно и то же соединение
+ *
+ * @param socket Соединение, по которому только что пришел кадр Hello
+ */
+void NetworkManager::dropDuplicatePeerLink(QTcpSocket *socket)
+{
+    const quint64 peerNodeId = m_connections.value(socket).peerNodeId;
+    QTcpSocket *other = nullptr;
+    for (auto it = m_connections.cbegin(); it != m_connections.cend(); ++it) {
+        if (it.key() != socket && it->isPeer && it->peerNodeId == peerNodeId) {
+            other = it.key();
+            break;
+        }
+    }
+    if (!other) return;
+    
+    const bool keepDialed = m_nodeId < peerNodeId;
+    QTcpSocket *redundant = m_connections.value(socket).dialed == keepDialed ? other : socket;
+    
+    // Свое соединение не восстанавливаем, пока живо встречное
+    for (PeerLink &link : m_peerLinks) {
+        if (link.socket == redundant) {
+            link.replacedBy = peerNodeId;
+        }
+    }
+    redundant->abort();
+}
+
+/**
+ * Запоминает идентификатор сообщения
+ * Набор ограничен по размеру: самые старые идентификаторы вытесняются
+ * 
+ * @param originId Узел, на котором появилось сообщение
+ * @param sequence Номер сообщения на этом узле
+ * @return true, если сообщение встречено впервые
+ */
+bool NetworkManager::markSeen(quint64 originId, quint64 sequence)
+{
+    const QPair<quint64, quint64> id(originId, sequence);
+    if (m_seenMessages.contains(id)) {
+        return false;
+    }
+    
+    m_seenMessages.insert(id);
+    m_seenOrder.enqueue(id);
+    if (m_seenOrder.size() > SeenMessagesLimit) {
+        m_seenMessages.remove(m_seenOrder.dequeue());
+    }
+    return true;
+}
+
+/**
+ * Пересылает сообщение остальным соединениям
+ * Сообщение уходит во все соединения, кроме того, из которого пришло, в том числе
+ * другим ретрансляторам: сеть не обязана быть полной, сообщение обойдет цепочку
+ * A-B-C. Узел пересылает сообщение только при первой встрече (markSeen), поэтому
+ * циклы не возникают, а по каждому соединению оно проходит не более двух раз
+ * 
+ * @param from Сокет, из которого получено сообщение
+ * @param frame Кадр сообщения с идентификатором
+ * @param context Контекст трассировки приема для продолжения трассы на следующих узлах
+ */
+void NetworkManager::relayMessage(QTcpSocket *from, WireProtocol::Frame frame, const Tracer::Context &context)
+{
+    if (context.isValid()) {
+        frame.flags |= WireProtocol::HasTraceContext;
+        frame.traceId = context.traceId;
+        frame.parentSpanId = context.spanId;
+    }
+    const QByteArray data = WireProtocol::encode(frame);
+    
+    for (auto it = m_connections.cbegin(); it != m_connections.cend(); ++it) {
+        if (it.key() == from || it.key()->state() != QTcpSocket::ConnectedState) continue;
+        
+        queueFrame(it.key(), data);
+        ++m_stats.messagesRelayed;
+    }
+}
@@ -4,18 +4,107 @@
 #include <QObject>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QSslSocket>
+#include <QSslConfiguration>
+#include <QSslError>
 #include <QHostAddress>
+#include <QHash>
+#include <QSet>
+#include <QQueue>
+#include <QPair>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
 #include <QDebug>
+#include "wireprotocol.h"
+#include "timerwheel.h"
+#include "trafficcapture.h"
+#include "tracer.h"
+
+/*
+ * TCP-сервер с необязательным шифрованием
+ * Если задана конфигурация TLS, входящие подключения оборачиваются в QSslSocket
+ * и сразу начинают серверное рукопожатие, иначе работают как обычные TCP-сокеты
+ * Все подключения используют общие ключи билетов сессий, поэтому клиент,
+ * предъявивший билет, возобновляет сессию без полного рукопожатия
+ * (требуется сборка с OpenSSL, см. CHAT_SHARED_TICKET_KEYS)
+ */
+class TlsServer : public QTcpServer
+{
+public:
+    explicit TlsServer(QObject *parent = nullptr) : QTcpServer(parent) {}
+
+    // Задает конфигурацию TLS; пустая конфигурация отключает шифрование
+    void setSslConfiguration(const QSslConfiguration &configuration) { m_configuration = configuration; }
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    // Задает контексту TLS сокета общие ключи билетов сессий
+    void shareTicketKeys(QSslSocket *socket);
+
+    QSslConfiguration m_configuration;
+    // Ключи билетов сессий, общие для всех подключений
+    QByteArray m_ticketKeys;
+};
 
 /*
  * Класс для управления сетевым взаимодействием
  * Выступает как в роли сервера, так и в роли клиента,
  * обеспечивая двустороннюю связь между приложениями чата
+ * Сервер принимает любое число клиентов; зависшие соединения выявляются
+ * кадрами ping/pong и закрываются по таймауту бездействия
+ * В режиме ретрансляции несколько серверов соединяются между собой в сеть
+ * произвольной связной формы: каждый узел пересылает впервые встреченное сообщение
+ * всем соединениям, кроме источника, а повторы отсекаются по идентификатору
+ * сообщения. Если два узла указали друг друга соседями, между ними остается
+ * одно соединение - установленное узлом с меньшим идентификатором
  */
 class NetworkManager : public QObject
 {
     Q_OBJECT
 public:
+    // Параметры сокетов и объединения записей, задаются для конкретного развертывания
+    struct SocketOptions
+    {
+        // Отключение алгоритма Нейгла (TCP_NODELAY)
+        bool lowDelay = true;
+        // Проверка живости соединения средствами TCP (SO_KEEPALIVE)
+        bool keepAlive = true;
+        // Размеры буферов отправки и приема ядра; 0 оставляет системные значения
+        int sendBufferSize = 0;
+        int receiveBufferSize = 0;
+        // Максимальная задержка отправки при потоке сообщений, мс
+        int maxCoalesceDelayMs = 2;
+        // Объем накопленных данных, при котором запись выполняется немедленно
+        int flushThresholdBytes = 64 * 1024;
+        // Бездействие, после которого соединению отправляется ping, мс (0 отключает)
+        int pingIntervalMs = 15000;
+        // Бездействие, после которого соединение закрывается, мс
+        int idleTimeoutMs = 45000;
+    };
+
+    // Счетчики сетевой активности
+    struct Stats
+    {
+        quint64 framesSent = 0;
+        quint64 framesReceived = 0;
+        quint64 bytesSent = 0;
+        quint64 bytesReceived = 0;
+        // Число вызовов write у сокетов: меньше framesSent благодаря объединению
+        quint64 writeCalls = 0;
+        quint64 pingsSent = 0;
+        // Соединения, закрытые из-за отсутствия ответа
+        quint64 connectionsReaped = 0;
+        // Сообщения, пересланные другим соединениям в режиме ретрансляции
+        quint64 messagesRelayed = 0;
+        // Повторно полученные сообщения, отброшенные по идентификатору
+        quint64 duplicatesDropped = 0;
+        // Исходящие подключения TLS, возобновившие сессию по билету
+        quint64 sessionsResumed = 0;
+    };
+
     // Конструктор класса
     explicit NetworkManager(QObject *parent = nullptr);
     // Деструктор класса
@@ -25,20 +114,52 @@ public:
     bool startServer(int port);
     // Подключается к серверу по адресу и порту
     bool connectToServer(const QString &address, int port);
-    // Отправляет сообщение через активные соединения
-    void sendMessage(const QString &message);
+    // Отправляет сообщение через активные соединения и возвращает назначенный ему идентификатор
+    WireProtocol::MessageOrigin sendMessage(const QString &message);
     // Закрывает все активные соединения
     void closeConnections();
+    // Включает TLS с сертификатом и закрытым ключом в формате PEM
+    bool setTlsCredentials(const QString &certificatePath, const QString &keyPath);
+    // Признак использования TLS
+    bool isTlsEnabled() const;
+    // Порт, на котором слушает сервер (полезно при запуске на порту 0)
+    quint16 serverPort() const;
+    // Задает параметры сокетов; применяются к новым соединениям
+    void setSocketOptions(const SocketOptions &options);
+    SocketOptions socketOptions() const;
+    // Возвращает счетчики сетевой активности
+    Stats stats() const;
+    // Число открытых соединений
+    int connectionCount() const;
+    // Начинает запись входящих и исходящих кадров в файл для последующего воспроизведения
+    bool startCapture(const QString &path);
+    // Останавливает запись трафика
+    void stopCapture();
+    // Включает пересылку сообщений между клиентами и другими ретрансляторами
+    void setRelayEnabled(bool enabled);
+    bool isRelayEnabled() const;
+    // Добавляет соседний ретранслятор; соединение с ним восстанавливается автоматически
+    void addRelayPeer(const QString &address, int port);
+    // Идентификатор этого узла в сети ретрансляторов
+    quint64 nodeId() const;
+    // Идентификаторы установленных соединений
+    QList<quint64> connectionIds() const;
+    // Отправляет кадр сверки истории в соединение; false, если соединения уже нет
+    bool sendSyncFrame(quint64 connectionId, const QByteArray &body);
 
 signals:
-    // Сигнал о получении нового сообщения
-    void messageReceived(const QString &message);
+    // Сигнал о получении нового сообщения и его идентификатора
+    void messageReceived(const QString &message, const WireProtocol::MessageOrigin &origin);
     // Сигнал об успешном подключении
     void connected();
     // Сигнал о разрыве соединения
     void disconnected();
     // Сигнал об ошибке в сети
     void error(const QString &errorMessage);
+    // Сигнал о получении кадра сверки истории
+    void syncFrameReceived(quint64 connectionId, const QByteArray &body);
+    // Сигнал о закрытии соединения с указанным идентификатором
+    void connectionClosed(quint64 connectionId);
 
 private slots:
     // Обработчик нового подключения к серверу
@@ -51,16 +172,130 @@ private slots:
     void onConnected();
     // Обработчик ошибок сокета
     void onSocketError(QAbstractSocket::SocketError socketError);
+    // Обработчик получения билета сессии TLS для последующего возобновления
+    void onSessionTicketReceived();
+    // Обработчик ошибок проверки сертификата
+    void onSslErrors(const QList<QSslError> &errors);
+    // Отправляет накопленные кадры всех соединений
+    void flushPendingWrites();
+    // Проверяет активность соединения по сроку из колеса таймеров
+    void onHeartbeatExpired(quint64 connectionId);
 
 private:
+    // Состояние отдельного соединения
+    struct Connection
+    {
+        // Идентификатор соединения для колеса таймеров
+        quint64 id = 0;
+        // Время последнего принятого кадра по часам m_clock, мс
+        qint64 lastActivityMs = 0;
+        // Отправлен ping, ответ на который еще не получен
+        bool pingOutstanding = false;
+        // Соединение с другим ретранслятором, а не с клиентом
+        bool isPeer = false;
+        // Соединение установлено нами как соседнее (PeerLink), а не принято сервером
+        bool dialed = false;
+        // Идентификатор узла на другой стороне, известный из его кадра Hello
+        quint64 peerNodeId = 0;
+        // Принятые, но еще не разобранные байты
+        QByteArray readBuffer;
+        // Кадры, ожидающие отправки одним вызовом write
+        QByteArray writeBuffer;
+        // Соединение уже стоит в очереди на отправку
+        bool flushScheduled = false;
+    };
+
+    // Регистрирует сокет и подключает его сигналы чтения
+    void attachSocket(QTcpSocket *socket);
+    // Удаляет состояние соединения для сокета
+    void detachSocket(QTcpSocket *socket);
+    // Применяет параметры сокета к установленному соединению
+    void applySocketOptions(QTcpSocket *socket);
+    // Ставит закодированный кадр в очередь отправки соединения
+    void queueFrame(QTcpSocket *socket, const QByteArray &data);
+    // Записывает накопленные кадры соединения в сокет
+    void flushSocket(QTcpSocket *socket, Connection &connection);
+    // Обрабатывает один разобранный кадр
+    void handleFrame(QTcpSocket *socket, const WireProtocol::Frame &frame,
+                     quint64 decodeStartUs, quint64 decodeEndUs);
+    // Отправляет служебный кадр без тела
+    void sendControlFrame(QTcpSocket *socket, WireProtocol::FrameType type);
+    // Закрывает соединение, переставшее отвечать
+    void reapConnection(QTcpSocket *socket);
+    // Запоминает идентификатор сообщения; false, если сообщение уже встречалось
+    bool markSeen(quint64 originId, quint64 sequence);
+    // Пересылает сообщение остальным соединениям в режиме ретрансляции
+    void relayMessage(QTcpSocket *from, WireProtocol::Frame frame, const Tracer::Context &context);
+    // Устанавливает соединение с соседним ретранслятором
+    void connectPeerLink(int index);
+    // Обрабатывает потерю соединения с соседним ретранслятором и планирует переподключение
+    void onPeerLinkLost(QTcpSocket *socket);
+    // Планирует повторное подключение к соседнему ретранслятору
+    void schedulePeerReconnect(int index);
+    // Представляет этот узел кадром Hello
+    void sendHello(QTcpSocket *socket);
+    // Закрывает второе соединение с тем же соседом, если узлы подключились друг к другу
+    void dropDuplicatePeerLink(QTcpSocket *socket);
+
     // Объект сервера TCP
-    QTcpServer *m_server;
-    // Сокет для входящего подключения (когда мы сервер)
-    QTcpSocket *m_clientSocket;
+    TlsServer *m_server;
     // Сокет для исходящего подключения (когда мы клиент)
     QTcpSocket *m_socket;
     // Флаг состояния подключения
     bool m_isConnected;
+    // Конфигурация TLS (пустая, если шифрование выключено)
+    QSslConfiguration m_tlsConfiguration;
+    // Адрес текущего исходящего подключения в виде "хост:порт"
+    QString m_peerKey;
+    // Билеты сессий TLS по адресам серверов для возобновления сессии при переподключении
+    QHash<QString, QByteArray> m_sessionTickets;
+    // Параметры сокетов
+    SocketOptions m_socketOptions;
+    // Счетчики сетевой активности
+    Stats m_stats;
+    // Таймер отложенной отправки накопленных кадров
+    QTimer *m_flushTimer;
+    // Соединения с неотправленными кадрами
+    QVector<QTcpSocket*> m_pendingSockets;
+    // Монотонные часы для интервалов отправки и учета активности
+    QElapsedTimer m_clock;
+    // Время последней постановки кадра в очередь, нс
+    qint64 m_lastQueueNs;
+    // Сглаженный интервал между кадрами, нс
+    qint64 m_averageIntervalNs;
+    // Состояние соединений по сокетам (входящих и исходящего)
+    QHash<QTcpSocket*, Connection> m_connections;
+    // Сокеты по идентификаторам соединений
+    QHash<quint64, QTcpSocket*> m_socketsById;
+    // Следующий идентификатор соединения
+    quint64 m_nextConnectionId;
+    // Общее колесо таймеров для проверок активности всех соединений
+    TimerWheel *m_heartbeatWheel;
+    // Запись трафика (неактивна, пока не вызван startCapture)
+    TrafficCapture m_capture;
+
+    // Соседний ретранслятор, к которому мы подключаемся сами
+    struct PeerLink
+    {
+        QString address;
+        int port = 0;
+        QTcpSocket *socket = nullptr;
+        // Идентификатор соседа, чье встречное соединение заменяет наше (0, если не заменено);
+        // пока оно живо, наше соединение не восстанавливается
+        quint64 replacedBy = 0;
+    };
+
+    // Идентификатор узла, случайный для каждого запуска
+    quint64 m_nodeId;
+    // Номер последнего сообщения, появившегося на этом узле
+    quint64 m_sequence;
+    // Режим ретрансляции
+    bool m_relayEnabled;
+    // Соседние ретрансляторы
+    QVector<PeerLink> m_peerLinks;
+    // Идентификаторы недавно встреченных сообщений и порядок их вытеснения
+    QSet<QPair<quint64, quint64>> m_seenMessages;
+    QQueue<QPair<quint64, quint64>> m_seenOrder;
 };
 
 #endif // NETWORKMANAGER_H 
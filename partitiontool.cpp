@@ -0,0 +1,53 @@
+#include "partitiontool.h"
+#include "commandlineoptions.h"
+#include "databasemanager.h"
+#include <QFileInfo>
+#include <QTextStream>
+#include <utility>
+
+/**
+ * Печатает и удаляет разделы истории согласно аргументам
+ *
+ * @param arguments Аргументы командной строки
+ * @return Код завершения процесса
+ */
+int runPartitionTool(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+
+    const QString dbPath = argumentValue(arguments, "--db", "chat.db");
+    const QString dropBefore = argumentValue(arguments, "--drop-before");
+    QStringList drops = argumentValues(arguments, "--drop");
+
+    DatabaseManager database;
+    if (!database.openDatabase(dbPath)) {
+        out << "Не удалось открыть базу данных " << dbPath << Qt::endl;
+        return 1;
+    }
+
+    // Раздел дня 20261005 относится к месяцу 202610, поэтому сравниваем по общей длине ключей
+    for (const QString &key : database.partitions()) {
+        const int length = qMin(key.size(), dropBefore.size());
+        if (!dropBefore.isEmpty() && key.left(length) < dropBefore.left(length)) {
+            drops.append(key);
+        }
+    }
+
+    int failures = 0;
+    for (const QString &key : std::as_const(drops)) {
+        if (database.dropPartition(key)) {
+            out << "Удален раздел " << key << Qt::endl;
+        } else {
+            out << "Не удалось удалить раздел " << key << Qt::endl;
+            ++failures;
+        }
+    }
+
+    const QStringList keys = database.partitions();
+    out << "Разделов: " << keys.size() << Qt::endl;
+    for (const QString &key : keys) {
+        out << key << "\t" << QFileInfo(database.partitionPath(key)).size() << " байт" << Qt::endl;
+    }
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#ifndef PARTITIONTOOL_H
+#define PARTITIONTOOL_H
+
+#include <QStringList>
+
+/*
+ * Обслуживание разделов истории без графического интерфейса
+ * Печатает разделы базы данных с размерами файлов и удаляет устаревшие:
+ * удаление раздела сводится к удалению его файла и не зависит от числа сообщений
+ *
+ * Запуск: PR_2_chat --partitions [--db chat.db] [--drop <ключ> ...] [--drop-before <ключ>]
+ * Ключ раздела имеет вид yyyyMM (раздел месяца) или yyyyMMdd (раздел дня)
+ */
+int runPartitionTool(const QStringList &arguments);
+
+#endif // PARTITIONTOOL_H
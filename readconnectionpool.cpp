@@ -0,0 +1,72 @@
+#include "readconnectionpool.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QThread>
+#include <utility>
+
+ReadConnectionPool::~ReadConnectionPool()
+{
+    closeAll();
+}
+
+/**
+ * Возвращает подключение только для чтения, принадлежащее текущему потоку
+ * Имя подключения включает адрес пула, поток и путь к файлу, поэтому
+ * несколько менеджеров базы данных в одном процессе не пересекаются
+ * Если у потока открыто больше MaxConnectionsPerThread подключений, дольше всех
+ * не использованное закрывается. Поток выполняет один запрос за раз, поэтому
+ * закрываемое подключение им уже не используется
+ *
+ * @param path Путь к файлу базы данных
+ * @return Подключение; при ошибке открытия оно остается закрытым
+ */
+QSqlDatabase ReadConnectionPool::connection(const QString &path)
+{
+    QThread *thread = QThread::currentThread();
+    const QString name = QString("reader_%1_%2_%3")
+            .arg(quintptr(this))
+            .arg(quintptr(thread))
+            .arg(path);
+
+    QStringList evicted;
+    {
+        QMutexLocker locker(&m_mutex);
+        QStringList &recent = m_recent[thread];
+        recent.removeOne(name);
+        recent.prepend(name);
+        while (recent.size() > MaxConnectionsPerThread) {
+            evicted.append(recent.takeLast());
+        }
+    }
+    for (const QString &evictedName : std::as_const(evicted)) {
+        QSqlDatabase::removeDatabase(evictedName);
+    }
+
+    if (QSqlDatabase::contains(name)) {
+        return QSqlDatabase::database(name);
+    }
+
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", name);
+    database.setDatabaseName(path);
+    database.setConnectOptions("QSQLITE_OPEN_READONLY");
+    if (!database.open()) {
+        qDebug() << "Ошибка открытия подключения для чтения:" << database.lastError().text();
+    }
+    return database;
+}
+
+/**
+ * Удаляет все подключения пула
+ * Вызывается после завершения потоков-читателей, например перед удалением
+ * файла раздела, который они держат открытым
+ */
+void ReadConnectionPool::closeAll()
+{
+    QMutexLocker locker(&m_mutex);
+    for (const QStringList &names : std::as_const(m_recent)) {
+        for (const QString &name : names) {
+            QSqlDatabase::removeDatabase(name);
+        }
+    }
+    m_recent.clear();
+}
@@ -0,0 +1,44 @@
+#ifndef READCONNECTIONPOOL_H
+#define READCONNECTIONPOOL_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+class QThread;
+
+/*
+ * Пул подключений к SQLite только для чтения
+ * Каждый поток получает собственное именованное подключение к каждому файлу
+ * и переиспользует его между запросами, т.к. подключение Qt нельзя
+ * передавать между потоками. В режиме WAL такие читатели не блокируют
+ * запись и не блокируются ею. У потока открыто не более MaxConnectionsPerThread
+ * подключений: при чтении всей истории по дневным разделам давно не нужные
+ * подключения закрываются, и число открытых файлов не растет с числом разделов
+ */
+class ReadConnectionPool
+{
+public:
+    // Число подключений, которые поток держит открытыми между запросами
+    static const int MaxConnectionsPerThread = 4;
+
+    ReadConnectionPool() = default;
+    ~ReadConnectionPool();
+
+    // Подключение текущего потока к файлу; открывается при первом обращении
+    QSqlDatabase connection(const QString &path);
+    // Удаляет все подключения; потоки, которые их открыли, должны быть уже завершены
+    void closeAll();
+
+private:
+    Q_DISABLE_COPY(ReadConnectionPool)
+
+    // Защищает списки имен, подключения открываются из разных потоков
+    QMutex m_mutex;
+    // Имена открытых подключений каждого потока, недавно использованные впереди
+    QHash<QThread*, QStringList> m_recent;
+};
+
+#endif // READCONNECTIONPOOL_H
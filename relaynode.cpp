@@ -0,0 +1,86 @@
+#include "relaynode.h"
+#include "commandlineoptions.h"
+#include "databasemanager.h"
+#include "historysync.h"
+#include "networkmanager.h"
+#include <QCoreApplication>
+#include <QTextStream>
+#include <QTimer>
+
+/**
+ * Запускает узел-ретранслятор и обрабатывает события до завершения процесса
+ *
+ * @param arguments Аргументы командной строки
+ * @return Код завершения процесса
+ */
+int runRelayNode(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+
+    const int port = argumentValue(arguments, "--listen").toInt();
+    const int statsMs = argumentValue(arguments, "--stats-ms", "10000").toInt();
+    const QString dbPath = argumentValue(arguments, "--db", "chat.db");
+    const QStringList peers = argumentValues(arguments, "--peer");
+    const bool dayPartitions = argumentValue(arguments, "--partition") == "day";
+    const QString capturePath = argumentValue(arguments, "--capture");
+
+    if (port <= 0) {
+        out << "Укажите порт узла: --listen <порт>" << Qt::endl;
+        return 2;
+    }
+
+    // Каждый узел журналирует сообщения в собственную базу данных
+    DatabaseManager database;
+    database.setPartitionScheme(dayPartitions ? DatabaseManager::PartitionByDay : DatabaseManager::PartitionByMonth);
+    if (!database.openDatabase(dbPath)) {
+        out << "Не удалось открыть базу данных " << dbPath << Qt::endl;
+        return 1;
+    }
+
+    NetworkManager network;
+    network.setRelayEnabled(true);
+    QObject::connect(&network, &NetworkManager::messageReceived,
+                     [&database](const QString &message, const WireProtocol::MessageOrigin &origin) {
+        database.logMessage(message, true, origin);
+    });
+    QObject::connect(&network, &NetworkManager::error, [&out](const QString &message) {
+        out << message << Qt::endl;
+    });
+
+    // Запись трафика узла для последующего воспроизведения через --replay
+    if (!capturePath.isEmpty() && !network.startCapture(capturePath)) {
+        out << "Не удалось начать запись трафика в " << capturePath << Qt::endl;
+        return 1;
+    }
+
+    // Клиенты могут сверить свою историю с журналом узла
+    HistorySync historySync(&database, &network);
+
+    if (!network.startServer(port)) {
+        return 1;
+    }
+
+    for (const QString &peer : peers) {
+        network.addRelayPeer(peer.section(':', 0, 0), peer.section(':', 1, 1).toInt());
+    }
+
+    out << "Узел " << QString::number(network.nodeId(), 16) << " слушает порт " << port
+        << ", соседей: " << peers.size() << Qt::endl;
+
+    // Периодически печатаем счетчики, чтобы видеть нагрузку на узел
+    QTimer statsTimer;
+    if (statsMs > 0) {
+        QObject::connect(&statsTimer, &QTimer::timeout, [&network, &out]() {
+            const NetworkManager::Stats stats = network.stats();
+            out << "Соединений: " << network.connectionCount()
+                << ", принято кадров: " << stats.framesReceived
+                << ", переслано: " << stats.messagesRelayed
+                << ", повторов: " << stats.duplicatesDropped
+                << ", ping: " << stats.pingsSent
+                << ", закрыто по таймауту: " << stats.connectionsReaped << Qt::endl;
+        });
+        statsTimer.start(statsMs);
+    }
+
+    return QCoreApplication::exec();
+}
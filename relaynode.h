@@ -0,0 +1,19 @@
+#ifndef RELAYNODE_H
+#define RELAYNODE_H
+
+#include <QStringList>
+
+/*
+ * Узел-ретранслятор без графического интерфейса
+ * Слушает порт, подключается к соседним ретрансляторам и журналирует
+ * все сообщения в собственную базу данных. Несколько узлов на 127.0.0.1
+ * образуют сеть, емкость которой растет добавлением процессов; сеть может
+ * быть любой связной, например цепочкой, соседей достаточно указать с одной стороны
+ *
+ * Запуск: PR_2_chat --relay-node --listen 9001 --peer 127.0.0.1:9002
+ *         [--peer 127.0.0.1:9003 ...] [--db node1.db] [--partition day|month] [--stats-ms 10000]
+ *         [--capture node1.bin]
+ */
+int runRelayNode(const QStringList &arguments);
+
+#endif // RELAYNODE_H
@@ -0,0 +1,403 @@
+#include "replaytool.h"
+#include "commandlineoptions.h"
+#include "databasemanager.h"
+#include "networkmanager.h"
+#include "trafficcapture.h"
+#include "wireprotocol.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QQueue>
+#include <QRandomGenerator>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+#include <memory>
+
+namespace {
+
+// Число кадров, отправляемых за одну итерацию цикла событий в режиме без пауз
+const int MaxBatchSize = 512;
+// Время ожидания ответов на ping после отправки всех кадров
+const int DrainTimeoutMs = 2000;
+
+// Перцентиль набора замеров (значения сортируются на месте)
+qint64 percentile(QVector<qint64> &values, double fraction)
+{
+    if (values.isEmpty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    const int index = qBound(0, int(fraction * values.size()), values.size() - 1);
+    return values.at(index);
+}
+
+/**
+ * Дает сообщениям записи новые идентификаторы для этого запуска
+ * Сервер помнит идентификаторы встреченных сообщений, поэтому повторное
+ * воспроизведение той же записи (или воспроизведение в процесс, который ее сделал)
+ * отбрасывалось бы целиком как повторы. Узел-источник заменяется на исходный,
+ * смешанный со случайным значением запуска: сообщения одного узла остаются
+ * сообщениями одного узла, а номера сохраняются
+ *
+ * @param records Записи трафика
+ * @param runKey Случайное значение запуска
+ */
+void restampMessages(QVector<TrafficCapture::Record> &records, quint64 runKey)
+{
+    for (TrafficCapture::Record &record : records) {
+        if (record.kind != TrafficCapture::InboundFrame || record.data.size() <= 4
+                || quint8(record.data.at(4)) != WireProtocol::MessageFrame) {
+            continue;
+        }
+
+        int offset = 0;
+        WireProtocol::Frame frame;
+        if (WireProtocol::decode(record.data, offset, frame) == WireProtocol::Decoded
+                && (frame.flags & WireProtocol::HasMessageId)) {
+            frame.originId ^= runKey;
+            record.data = WireProtocol::encode(frame);
+        }
+    }
+}
+
+/*
+ * Сеанс воспроизведения: расписание кадров, сокеты и замеры
+ */
+class ReplaySession
+{
+public:
+    ReplaySession(const QVector<TrafficCapture::Record> &records, const QString &host,
+                  quint16 port, double speed, int probeMs)
+        : m_records(records)
+        , m_host(host)
+        , m_port(port)
+        , m_speed(speed)
+        , m_next(0)
+        , m_finished(false)
+        , m_framesSent(0)
+        , m_bytesSent(0)
+        , m_connectionsOpened(0)
+        , m_socketErrors(0)
+        , m_probeCursor(0)
+    {
+        m_baseNs = m_records.isEmpty() ? 0 : m_records.first().timestampNs;
+
+        m_dispatchTimer.setSingleShot(true);
+        m_dispatchTimer.setTimerType(Qt::PreciseTimer);
+        QObject::connect(&m_dispatchTimer, &QTimer::timeout, [this]() { dispatch(); });
+
+        m_probeTimer.setInterval(qMax(1, probeMs));
+        QObject::connect(&m_probeTimer, &QTimer::timeout, [this]() { probe(); });
+    }
+
+    ~ReplaySession()
+    {
+        for (Connection *connection : std::as_const(m_connections)) {
+            connection->socket->abort();
+            delete connection->socket;
+            delete connection;
+        }
+    }
+
+    // Воспроизводит все записи и возвращает управление после получения ответов
+    void run()
+    {
+        m_clock.start();
+        m_probeTimer.start();
+        // Отправка начинается из цикла событий: если все записи уйдут сразу,
+        // вызов quit должен прийти в уже запущенный цикл, иначе он будет потерян
+        QTimer::singleShot(0, &m_loop, [this]() { dispatch(); });
+        m_loop.exec();
+    }
+
+    // Печатает результаты замеров
+    void report(QTextStream &out)
+    {
+        const double seconds = qMax(1e-9, double(m_elapsedNs) / 1e9);
+        out << "Отправлено кадров: " << m_framesSent << " (" << m_bytesSent << " байт) за "
+            << QString::number(seconds, 'f', 3) << " с" << Qt::endl;
+        out << "Пропускная способность: " << QString::number(m_framesSent / seconds, 'f', 0)
+            << " кадров/с, " << QString::number(m_bytesSent / seconds / (1024 * 1024), 'f', 2)
+            << " МБ/с" << Qt::endl;
+        out << "Соединений: " << m_connectionsOpened << ", ошибок сокетов: " << m_socketErrors << Qt::endl;
+
+        const int samples = m_roundTripNs.size();
+        out << "Задержка ping/pong, мкс: p50 " << percentile(m_roundTripNs, 0.5) / 1000
+            << ", p99 " << percentile(m_roundTripNs, 0.99) / 1000
+            << ", макс " << percentile(m_roundTripNs, 1.0) / 1000
+            << " (" << samples << " замеров)" << Qt::endl;
+
+        if (m_speed > 0) {
+            out << "Отставание от расписания, мкс: p50 " << percentile(m_lagNs, 0.5) / 1000
+                << ", p99 " << percentile(m_lagNs, 0.99) / 1000 << Qt::endl;
+        }
+    }
+
+private:
+    // Воспроизводимое соединение
+    struct Connection
+    {
+        QTcpSocket *socket = nullptr;
+        QByteArray readBuffer;
+        // Время отправки ping, ответ на которые еще не пришел
+        QQueue<qint64> pingSentNs;
+    };
+
+    // Отправляет записи, время которых наступило, и планирует следующий вызов
+    void dispatch()
+    {
+        const qint64 nowNs = m_clock.nsecsElapsed();
+        int batch = 0;
+
+        while (m_next < m_records.size()) {
+            const TrafficCapture::Record &record = m_records.at(m_next);
+
+            if (m_speed > 0) {
+                const qint64 dueNs = qint64((record.timestampNs - m_baseNs) / m_speed);
+                if (dueNs > nowNs) {
+                    m_dispatchTimer.start(int((dueNs - nowNs) / 1000000));
+                    return;
+                }
+                m_lagNs.append(nowNs - dueNs);
+            } else if (++batch > MaxBatchSize) {
+                // Даем циклу событий записать накопленные данные в сокеты
+                m_dispatchTimer.start(0);
+                return;
+            }
+
+            apply(record);
+            ++m_next;
+        }
+
+        // Все записи отправлены: пропускная способность считается по фазе отправки,
+        // без ожидания ответов на ping
+        m_elapsedNs = m_clock.nsecsElapsed();
+        m_probeTimer.stop();
+        m_finished = true;
+        QTimer::singleShot(DrainTimeoutMs, &m_loop, &QEventLoop::quit);
+        finishIfDrained();
+    }
+
+    // Применяет одну запись
+    void apply(const TrafficCapture::Record &record)
+    {
+        switch (record.kind) {
+        case TrafficCapture::ConnectionOpened:
+            connection(record.connectionId);
+            break;
+        case TrafficCapture::ConnectionClosed:
+            closeConnection(record.connectionId);
+            break;
+        case TrafficCapture::InboundFrame:
+            sendFrame(connection(record.connectionId), record.data);
+            break;
+        case TrafficCapture::OutboundFrame:
+            // Ответы сервера он сформирует сам
+            break;
+        }
+    }
+
+    // Возвращает соединение по идентификатору из записи, открывая его при необходимости
+    Connection *connection(quint32 connectionId)
+    {
+        Connection *connection = m_connections.value(connectionId);
+        if (connection) {
+            return connection;
+        }
+
+        connection = new Connection;
+        connection->socket = new QTcpSocket;
+        connection->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        QObject::connect(connection->socket, &QTcpSocket::readyRead, [this, connection]() {
+            readFrames(connection);
+        });
+        QObject::connect(connection->socket, &QTcpSocket::errorOccurred, [this]() { ++m_socketErrors; });
+        connection->socket->connectToHost(m_host, m_port);
+
+        m_connections.insert(connectionId, connection);
+        ++m_connectionsOpened;
+        return connection;
+    }
+
+    // Закрывает соединение, как это было в записи
+    void closeConnection(quint32 connectionId)
+    {
+        Connection *connection = m_connections.take(connectionId);
+        if (!connection) {
+            return;
+        }
+
+        connection->socket->disconnect();
+        connection->socket->disconnectFromHost();
+        connection->socket->deleteLater();
+        delete connection;
+    }
+
+    // Отправляет готовый кадр и запоминает время отправки ping
+    void sendFrame(Connection *connection, const QByteArray &frame)
+    {
+        if (frame.size() > 4 && quint8(frame.at(4)) == WireProtocol::PingFrame) {
+            connection->pingSentNs.enqueue(m_clock.nsecsElapsed());
+        }
+
+        connection->socket->write(frame);
+        ++m_framesSent;
+        m_bytesSent += frame.size();
+    }
+
+    // Отправляет контрольный ping очередному открытому соединению
+    void probe()
+    {
+        const QList<Connection*> connections = m_connections.values();
+        for (int i = 0; i < connections.size(); ++i) {
+            Connection *connection = connections.at((m_probeCursor + i) % connections.size());
+            if (connection->socket->state() == QAbstractSocket::ConnectedState) {
+                m_probeCursor = (m_probeCursor + i + 1) % connections.size();
+                WireProtocol::Frame frame;
+                frame.type = WireProtocol::PingFrame;
+                sendFrame(connection, WireProtocol::encode(frame));
+                return;
+            }
+        }
+    }
+
+    // Разбирает ответы сервера и замеряет задержку по кадрам pong
+    void readFrames(Connection *connection)
+    {
+        connection->readBuffer.append(connection->socket->readAll());
+
+        int offset = 0;
+        WireProtocol::Frame frame;
+        while (WireProtocol::decode(connection->readBuffer, offset, frame) == WireProtocol::Decoded) {
+            if (frame.type == WireProtocol::PongFrame && !connection->pingSentNs.isEmpty()) {
+                m_roundTripNs.append(m_clock.nsecsElapsed() - connection->pingSentNs.dequeue());
+            }
+        }
+        connection->readBuffer.remove(0, offset);
+
+        finishIfDrained();
+    }
+
+    // Завершает сеанс, когда все записи отправлены и на все ping получены ответы
+    void finishIfDrained()
+    {
+        if (!m_finished) {
+            return;
+        }
+        for (const Connection *connection : std::as_const(m_connections)) {
+            if (!connection->pingSentNs.isEmpty()) {
+                return;
+            }
+        }
+        m_loop.quit();
+    }
+
+    const QVector<TrafficCapture::Record> &m_records;
+    QString m_host;
+    quint16 m_port;
+    // Коэффициент ускорения; 0 означает отправку без пауз
+    double m_speed;
+    int m_next;
+    bool m_finished;
+    qint64 m_baseNs;
+    qint64 m_elapsedNs = 0;
+
+    QEventLoop m_loop;
+    QTimer m_dispatchTimer;
+    QTimer m_probeTimer;
+    QElapsedTimer m_clock;
+    QHash<quint32, Connection*> m_connections;
+
+    quint64 m_framesSent;
+    quint64 m_bytesSent;
+    int m_connectionsOpened;
+    int m_socketErrors;
+    int m_probeCursor;
+    QVector<qint64> m_roundTripNs;
+    QVector<qint64> m_lagNs;
+};
+
+} // namespace
+
+/**
+ * Воспроизводит запись трафика и печатает результаты замеров
+ *
+ * @param arguments Аргументы командной строки
+ * @return Код завершения процесса
+ */
+int runReplay(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+
+    const QString capturePath = argumentValue(arguments, "--replay", QString());
+    const QString target = argumentValue(arguments, "--target", QString());
+    const QString speedArgument = argumentValue(arguments, "--speed", "1");
+    const int probeMs = argumentValue(arguments, "--probe-ms", "50").toInt();
+    const QString dbPath = argumentValue(arguments, "--db", QString());
+
+    QVector<TrafficCapture::Record> records;
+    QString errorMessage;
+    if (!TrafficCapture::readAll(capturePath, records, &errorMessage)) {
+        out << "Не удалось прочитать запись трафика: " << errorMessage << Qt::endl;
+        return 2;
+    }
+
+    // Перемаркировка идет до замера и не влияет на пропускную способность
+    restampMessages(records, QRandomGenerator::global()->generate64());
+
+    const double speed = speedArgument == "max" ? 0.0 : speedArgument.toDouble();
+    if (speedArgument != "max" && speed <= 0) {
+        out << "Скорость задается числом больше нуля или значением max" << Qt::endl;
+        return 2;
+    }
+
+    // Без адреса сервера поднимаем его в этом процессе
+    std::unique_ptr<NetworkManager> server;
+    std::unique_ptr<DatabaseManager> database;
+    int serverMessages = 0;
+    QString host = target.section(':', 0, 0);
+    quint16 port = quint16(target.section(':', 1, 1).toUInt());
+
+    if (target.isEmpty()) {
+        server.reset(new NetworkManager);
+        if (!server->startServer(0)) {
+            out << "Не удалось запустить локальный сервер" << Qt::endl;
+            return 1;
+        }
+        host = "127.0.0.1";
+        port = server->serverPort();
+
+        if (!dbPath.isEmpty()) {
+            database.reset(new DatabaseManager);
+            database->openDatabase(dbPath);
+        }
+        DatabaseManager *logger = database.get();
+        QObject::connect(server.get(), &NetworkManager::messageReceived,
+                         [&serverMessages, logger](const QString &message, const WireProtocol::MessageOrigin &origin) {
+            ++serverMessages;
+            if (logger) {
+                logger->logMessage(message, true, origin);
+            }
+        });
+    }
+
+    out << "Записей: " << records.size() << ", сервер " << host << ":" << port
+        << ", скорость " << speedArgument << Qt::endl;
+
+    {
+        ReplaySession session(records, host, port, speed, probeMs);
+        session.run();
+        session.report(out);
+    }
+
+    if (server) {
+        // Даем серверу дочитать данные, отправленные перед закрытием соединений
+        QCoreApplication::processEvents();
+        out << "Сервер принял сообщений: " << serverMessages << Qt::endl;
+    }
+    return 0;
+}
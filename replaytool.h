@@ -0,0 +1,21 @@
+#ifndef REPLAYTOOL_H
+#define REPLAYTOOL_H
+
+#include <QStringList>
+
+/*
+ * Воспроизведение записанного трафика для регрессионных замеров производительности
+ * Читает файл, записанный NetworkManager::startCapture, открывает по сокету
+ * на каждое записанное соединение и отправляет принятые тогда кадры в сервер
+ * с исходными интервалами, ускоренно или без пауз. Задержка сервера измеряется
+ * по кадрам ping/pong, в конце печатаются пропускная способность и перцентили задержки
+ * Сообщения получают новые идентификаторы при каждом запуске, поэтому запись
+ * можно воспроизводить в один и тот же сервер повторно
+ *
+ * Запуск: PR_2_chat --replay capture.bin [--target host:port] [--speed 1|N|max]
+ *         [--probe-ms 50] [--db replay.db]
+ * Без --target сервер поднимается в этом же процессе, а с --db он журналирует сообщения
+ */
+int runReplay(const QStringList &arguments);
+
+#endif // REPLAYTOOL_H
@@ -0,0 +1,90 @@
+#include "timerwheel.h"
+
+/**
+ * Конструктор колеса таймеров
+ *
+ * @param tickMs Длительность такта (точность срабатывания)
+ * @param slotCount Число ячеек; оборот колеса длится tickMs * slotCount
+ * @param parent Родительский объект
+ */
+TimerWheel::TimerWheel(int tickMs, int slotCount, QObject *parent)
+    : QObject(parent)
+    , m_tickMs(qMax(1, tickMs))
+    , m_currentTick(0)
+    , m_pendingCount(0)
+{
+    m_slots.resize(qMax(1, slotCount));
+    m_timer.setInterval(m_tickMs);
+    connect(&m_timer, &QTimer::timeout, this, &TimerWheel::onTick);
+}
+
+/**
+ * Планирует срабатывание для ключа
+ * Срок округляется вверх до целого числа тактов
+ *
+ * @param key Ключ, который будет передан в сигнал expired
+ * @param delayMs Задержка в миллисекундах
+ */
+void TimerWheel::schedule(quint64 key, int delayMs)
+{
+    const int slotCount = m_slots.size();
+    const quint64 ticks = qMax<quint64>(1, (quint64(qMax(0, delayMs)) + m_tickMs - 1) / m_tickMs);
+
+    Entry entry;
+    entry.key = key;
+    // Ячейка посещается раньше срока (ticks - 1) / slotCount раз
+    entry.rounds = int((ticks - 1) / quint64(slotCount));
+    m_slots[int((m_currentTick + ticks) % quint64(slotCount))].append(entry);
+    ++m_pendingCount;
+
+    if (!m_timer.isActive()) {
+        m_timer.start();
+    }
+}
+
+int TimerWheel::pendingCount() const
+{
+    return m_pendingCount;
+}
+
+int TimerWheel::tickMs() const
+{
+    return m_tickMs;
+}
+
+/**
+ * Продвигает колесо на один такт
+ * Сроки текущей ячейки с нулевым счетчиком оборотов срабатывают,
+ * у остальных счетчик уменьшается
+ */
+void TimerWheel::onTick()
+{
+    ++m_currentTick;
+    QVector<Entry> &slot = m_slots[int(m_currentTick % quint64(m_slots.size()))];
+    if (slot.isEmpty()) {
+        return;
+    }
+
+    // Обработчики могут планировать новые сроки, в том числе в эту же ячейку
+    QVector<Entry> entries;
+    entries.swap(slot);
+
+    QVector<quint64> expiredKeys;
+    for (Entry &entry : entries) {
+        if (entry.rounds == 0) {
+            expiredKeys.append(entry.key);
+        } else {
+            --entry.rounds;
+            slot.append(entry);
+        }
+    }
+    m_pendingCount -= expiredKeys.size();
+
+    for (quint64 key : expiredKeys) {
+        emit expired(key);
+    }
+
+    if (m_pendingCount == 0) {
+        m_timer.stop();
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+
+/*
+ * Хешированное колесо таймеров
+ * Все сроки обслуживаются одним QTimer: срок кладется в ячейку колеса по номеру
+ * такта срабатывания, а полные обороты колеса хранятся счетчиком в записи.
+ * Постановка срока стоит O(1), такт обходит только одну ячейку,
+ * поэтому колесо выдерживает десятки тысяч соединений
+ */
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+public:
+    // Создает колесо с длительностью такта tickMs и числом ячеек slotCount
+    explicit TimerWheel(int tickMs = 100, int slotCount = 1024, QObject *parent = nullptr);
+
+    // Планирует срабатывание для ключа не раньше чем через delayMs
+    void schedule(quint64 key, int delayMs);
+    // Число запланированных сроков
+    int pendingCount() const;
+    // Длительность такта в миллисекундах
+    int tickMs() const;
+
+signals:
+    // Срок для ключа истек; отмененные сроки отсеивает получатель
+    void expired(quint64 key);
+
+private slots:
+    // Продвигает колесо на один такт
+    void onTick();
+
+private:
+    // Запланированный срок
+    struct Entry
+    {
+        quint64 key;
+        // Сколько еще полных оборотов колеса ждать
+        int rounds;
+    };
+
+    // Ячейки колеса
+    QVector<QVector<Entry>> m_slots;
+    // Таймер тактов, работает только при наличии сроков
+    QTimer m_timer;
+    // Длительность такта
+    int m_tickMs;
+    // Номер текущего такта
+    quint64 m_currentTick;
+    // Число запланированных сроков
+    int m_pendingCount;
+};
+
+#endif // TIMERWHEEL_H
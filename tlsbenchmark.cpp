@@ -0,0 +1,205 @@
+#include "tlsbenchmark.h"
+#include "commandlineoptions.h"
+#include "networkmanager.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+// Результаты замеров для одного вида транспорта
+struct SuiteResult
+{
+    // Первое подключение: полное рукопожатие
+    qint64 fullHandshakeUs = 0;
+    // Повторные подключения к тому же серверу: при TLS возобновленные по билету
+    // и выполнившие полное рукопожатие, если сервер билет не принял
+    QVector<qint64> resumedHandshakeUs;
+    QVector<qint64> repeatFullHandshakeUs;
+    // Время доставки всей пачки сообщений
+    qint64 burstUs = 0;
+    // Число вызовов write у клиента после объединения кадров
+    quint64 writeCalls = 0;
+};
+
+// Обрабатывает события, пока условие не выполнится или не истечет время
+bool waitUntil(const std::function<bool()> &condition, int timeoutMs)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!condition()) {
+        if (timer.elapsed() > timeoutMs) {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::AllEvents);
+    }
+    return true;
+}
+
+// Обрабатывает события в течение заданного времени
+void settle(int ms)
+{
+    waitUntil([]() { return false; }, ms);
+}
+
+// Медиана набора замеров
+qint64 median(QVector<qint64> values)
+{
+    if (values.isEmpty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values.at(values.size() / 2);
+}
+
+/**
+ * Выполняет замеры для одного вида транспорта
+ *
+ * @param tls Использовать ли TLS
+ * @param certificatePath Путь к сертификату (для TLS)
+ * @param keyPath Путь к закрытому ключу (для TLS)
+ * @param connections Число подключений для замера рукопожатий
+ * @param messages Число сообщений в пачке
+ * @param size Размер одного сообщения в байтах
+ * @param result Результаты замеров
+ * @return true, если все замеры выполнены
+ */
+bool runSuite(bool tls, const QString &certificatePath, const QString &keyPath,
+              int connections, int messages, int size, SuiteResult &result)
+{
+    QTextStream err(stderr);
+    NetworkManager server;
+    NetworkManager client;
+
+    QObject::connect(&server, &NetworkManager::error, [&err](const QString &message) {
+        err << "Сервер: " << message << Qt::endl;
+    });
+    QObject::connect(&client, &NetworkManager::error, [&err](const QString &message) {
+        err << "Клиент: " << message << Qt::endl;
+    });
+
+    if (tls && (!server.setTlsCredentials(certificatePath, keyPath)
+                || !client.setTlsCredentials(certificatePath, keyPath))) {
+        return false;
+    }
+    if (!server.startServer(0)) {
+        return false;
+    }
+    const quint16 port = server.serverPort();
+
+    bool isConnected = false;
+    int acceptedConnections = 0;
+    int receivedMessages = 0;
+    QObject::connect(&client, &NetworkManager::connected, [&isConnected]() { isConnected = true; });
+    QObject::connect(&server, &NetworkManager::connected, [&acceptedConnections]() { ++acceptedConnections; });
+    QObject::connect(&server, &NetworkManager::messageReceived, [&receivedMessages](const QString &) {
+        ++receivedMessages;
+    });
+
+    // Замеряем рукопожатия: первое подключение и повторные к тому же серверу
+    // Возобновление определяется по счетчику клиента, проверяющему SSL_session_reused
+    quint64 sessionsResumed = 0;
+    for (int i = 0; i < connections; ++i) {
+        isConnected = false;
+        QElapsedTimer timer;
+        timer.start();
+        client.connectToServer("127.0.0.1", port);
+        if (!waitUntil([&isConnected]() { return isConnected; }, 5000)) {
+            err << "Превышено время ожидания подключения" << Qt::endl;
+            return false;
+        }
+
+        const qint64 elapsedUs = timer.nsecsElapsed() / 1000;
+        const quint64 resumed = client.stats().sessionsResumed;
+        if (i == 0) {
+            result.fullHandshakeUs = elapsedUs;
+        } else if (resumed > sessionsResumed) {
+            result.resumedHandshakeUs.append(elapsedUs);
+        } else {
+            result.repeatFullHandshakeUs.append(elapsedUs);
+        }
+        sessionsResumed = resumed;
+
+        // Даем серверу принять подключение
+        settle(10);
+    }
+
+    if (!waitUntil([&]() { return acceptedConnections >= connections; }, 5000)) {
+        err << "Сервер принял не все подключения" << Qt::endl;
+        return false;
+    }
+
+    // Замеряем доставку пачки сообщений по последнему подключению
+    const QString payload(size, QLatin1Char('x'));
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < messages; ++i) {
+        client.sendMessage(payload);
+    }
+    if (!waitUntil([&]() { return receivedMessages >= messages; }, 60000)) {
+        err << "Доставлено " << receivedMessages << " из " << messages << " сообщений" << Qt::endl;
+        return false;
+    }
+    result.burstUs = timer.nsecsElapsed() / 1000;
+    result.writeCalls = client.stats().writeCalls;
+
+    client.closeConnections();
+    server.closeConnections();
+    settle(10);
+    return true;
+}
+
+} // namespace
+
+/**
+ * Запускает сравнение обычного TCP и TLS и печатает таблицу результатов
+ *
+ * @param arguments Аргументы командной строки
+ * @return Код завершения процесса
+ */
+int runTlsBenchmark(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+
+    const QString certificatePath = argumentValue(arguments, "--tls-cert", QString());
+    const QString keyPath = argumentValue(arguments, "--tls-key", QString());
+    const int connections = qMax(2, argumentValue(arguments, "--bench-connections", "20").toInt());
+    const int messages = qMax(1, argumentValue(arguments, "--bench-messages", "10000").toInt());
+    const int size = qMax(1, argumentValue(arguments, "--bench-size", "64").toInt());
+
+    if (certificatePath.isEmpty() || keyPath.isEmpty()) {
+        out << "Укажите --tls-cert и --tls-key с самоподписанным сертификатом" << Qt::endl;
+        return 2;
+    }
+
+    SuiteResult plain;
+    SuiteResult tls;
+    if (!runSuite(false, QString(), QString(), connections, messages, size, plain)
+        || !runSuite(true, certificatePath, keyPath, connections, messages, size, tls)) {
+        out << "Замер прерван" << Qt::endl;
+        return 1;
+    }
+
+    const double plainPerMessageUs = double(plain.burstUs) / messages;
+    const double tlsPerMessageUs = double(tls.burstUs) / messages;
+
+    out << "Подключений: " << connections << ", сообщений: " << messages
+        << " по " << size << " байт" << Qt::endl;
+    out << qSetFieldWidth(20) << Qt::left << "Транспорт" << "Первое, мкс" << "Повторное, мкс"
+        << "Возобновленное, мкс" << "Сообщение, мкс" << qSetFieldWidth(0) << Qt::endl;
+    out << qSetFieldWidth(20) << "TCP" << plain.fullHandshakeUs << median(plain.repeatFullHandshakeUs) << "-"
+        << QString::number(plainPerMessageUs, 'f', 2) << qSetFieldWidth(0) << Qt::endl;
+    out << qSetFieldWidth(20) << "TLS" << tls.fullHandshakeUs << median(tls.repeatFullHandshakeUs)
+        << median(tls.resumedHandshakeUs) << QString::number(tlsPerMessageUs, 'f', 2)
+        << qSetFieldWidth(0) << Qt::endl;
+    out << "Вызовов write на " << messages << " сообщений: TCP " << plain.writeCalls
+        << ", TLS " << tls.writeCalls << Qt::endl;
+    out << "Возобновлено сессий TLS: " << tls.resumedHandshakeUs.size() << " из " << connections - 1
+        << Qt::endl;
+    out << "Накладные расходы TLS на сообщение: "
+        << QString::number(tlsPerMessageUs - plainPerMessageUs, 'f', 2) << " мкс" << Qt::endl;
+    return 0;
+}
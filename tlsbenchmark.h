@@ -0,0 +1,17 @@
+#ifndef TLSBENCHMARK_H
+#define TLSBENCHMARK_H
+
+#include <QStringList>
+
+/*
+ * Замер накладных расходов TLS на петлевом интерфейсе
+ * Поднимает сервер и клиент NetworkManager в одном процессе и сравнивает
+ * обычный TCP с TLS: время первого подключения, повторных подключений
+ * с возобновлением сессии по билету и без него и время доставки пачки сообщений
+ *
+ * Запуск: PR_2_chat --bench-tls --tls-cert cert.pem --tls-key key.pem
+ *         [--bench-connections 20] [--bench-messages 10000] [--bench-size 64]
+ */
+int runTlsBenchmark(const QStringList &arguments);
+
+#endif // TLSBENCHMARK_H
@@ -0,0 +1,319 @@
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRandomGenerator>
+#include <QSharedPointer>
+#include <QVector>
+#include <QDebug>
+
+#include <atomic>
+#include <chrono>
+
+namespace {
+
+// Запись о завершенном спане
+struct SpanRecord
+{
+    const char *name;
+    quint64 traceId;
+    quint64 spanId;
+    quint64 parentId;
+    quint64 startUs;
+    quint64 durationUs;
+    quint8 flow;
+};
+
+// Емкость кольцевого буфера одного потока
+const int ThreadBufferCapacity = 16384;
+
+/*
+ * Буфер спанов одного потока
+ * Пишет в него только владелец, поэтому мьютекс почти никогда не конкурирует:
+ * он нужен лишь на время выгрузки трассы из другого потока
+ */
+struct ThreadBuffer
+{
+    QMutex mutex;
+    QVector<SpanRecord> records;
+    int next = 0;
+    bool wrapped = false;
+    int threadIndex = 0;
+};
+
+std::atomic<bool> g_enabled(false);
+std::atomic<double> g_sampleRate(1.0);
+std::atomic<int> g_threadCounter(0);
+
+// Реестр буферов всех потоков; буфер переживает свой поток до выгрузки
+QMutex g_registryMutex;
+QList<QSharedPointer<ThreadBuffer>> g_registry;
+
+thread_local QSharedPointer<ThreadBuffer> t_buffer;
+thread_local Tracer::Context t_currentContext;
+
+// Возвращает буфер текущего потока, регистрируя его при первом обращении
+ThreadBuffer *threadBuffer()
+{
+    if (!t_buffer) {
+        t_buffer = QSharedPointer<ThreadBuffer>::create();
+        t_buffer->records.resize(ThreadBufferCapacity);
+        t_buffer->threadIndex = ++g_threadCounter;
+
+        QMutexLocker locker(&g_registryMutex);
+        g_registry.append(t_buffer);
+    }
+    return t_buffer.data();
+}
+
+// Представляет идентификатор строкой: в JSON числа теряют точность после 2^53
+QString idToString(quint64 id)
+{
+    return QStringLiteral("0x") + QString::number(id, 16);
+}
+
+} // namespace
+
+void Tracer::setEnabled(bool enabled)
+{
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Tracer::isEnabled()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void Tracer::setSampleRate(double rate)
+{
+    g_sampleRate.store(qBound(0.0, rate, 1.0), std::memory_order_relaxed);
+}
+
+/**
+ * Начинает новую трассу с учетом доли выборки
+ *
+ * @return Контекст новой трассы или пустой контекст, если сообщение не выбрано
+ */
+Tracer::Context Tracer::startTrace()
+{
+    Context context;
+    if (!isEnabled()) {
+        return context;
+    }
+
+    const double rate = g_sampleRate.load(std::memory_order_relaxed);
+    if (rate < 1.0 && QRandomGenerator::global()->generateDouble() >= rate) {
+        return context;
+    }
+
+    context.traceId = newId();
+    return context;
+}
+
+Tracer::Context Tracer::currentContext()
+{
+    return t_currentContext;
+}
+
+void Tracer::setCurrentContext(const Context &context)
+{
+    t_currentContext = context;
+}
+
+quint64 Tracer::nowMicros()
+{
+    // Системные часы, чтобы спаны разных процессов ложились на общую шкалу
+    using namespace std::chrono;
+    return quint64(duration_cast<microseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+quint64 Tracer::newId()
+{
+    quint64 id = 0;
+    while (id == 0) {
+        id = QRandomGenerator::global()->generate64();
+    }
+    return id;
+}
+
+/**
+ * Записывает завершенный спан в кольцевой буфер текущего потока
+ * При переполнении буфера самые старые спаны перезаписываются
+ *
+ * @param name Имя этапа (строковый литерал, хранится без копирования)
+ * @param parent Контекст родителя: трасса и родительский спан
+ * @param spanId Идентификатор записываемого спана
+ * @param startUs Время начала в микросекундах
+ * @param endUs Время окончания в микросекундах
+ * @param flow Роль спана в межпроцессной связи
+ */
+void Tracer::recordSpan(const char *name, const Context &parent, quint64 spanId,
+                        quint64 startUs, quint64 endUs, Flow flow)
+{
+    if (!isEnabled() || !parent.isValid()) {
+        return;
+    }
+
+    ThreadBuffer *buffer = threadBuffer();
+    QMutexLocker locker(&buffer->mutex);
+
+    SpanRecord &record = buffer->records[buffer->next];
+    record.name = name;
+    record.traceId = parent.traceId;
+    record.spanId = spanId;
+    record.parentId = parent.spanId;
+    record.startUs = startUs;
+    record.durationUs = endUs > startUs ? endUs - startUs : 0;
+    record.flow = quint8(flow);
+
+    if (++buffer->next == ThreadBufferCapacity) {
+        buffer->next = 0;
+        buffer->wrapped = true;
+    }
+}
+
+void Tracer::recordSpan(const char *name, const Context &parent, quint64 startUs, quint64 endUs)
+{
+    recordSpan(name, parent, newId(), startUs, endUs);
+}
+
+/**
+ * Выгружает спаны всех потоков в файл формата Chrome trace-event JSON
+ * Для связи спанов отправителя и получателя добавляются flow-события
+ * с идентификатором трассы, поэтому трассы двух процессов можно объединить
+ *
+ * @param path Путь к файлу трассы
+ * @return true при успешной записи
+ */
+bool Tracer::writeChromeTrace(const QString &path)
+{
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray events;
+
+    QList<QSharedPointer<ThreadBuffer>> buffers;
+    {
+        QMutexLocker locker(&g_registryMutex);
+        buffers = g_registry;
+    }
+
+    for (const QSharedPointer<ThreadBuffer> &buffer : buffers) {
+        QMutexLocker locker(&buffer->mutex);
+
+        const int count = buffer->wrapped ? ThreadBufferCapacity : buffer->next;
+        const int first = buffer->wrapped ? buffer->next : 0;
+
+        for (int i = 0; i < count; ++i) {
+            const SpanRecord &record = buffer->records.at((first + i) % ThreadBufferCapacity);
+
+            QJsonObject args;
+            args["trace_id"] = idToString(record.traceId);
+            args["span_id"] = idToString(record.spanId);
+            args["parent_id"] = idToString(record.parentId);
+
+            QJsonObject event;
+            event["name"] = QString::fromLatin1(record.name);
+            event["cat"] = "chat";
+            event["ph"] = "X";
+            event["ts"] = double(record.startUs);
+            event["dur"] = double(record.durationUs);
+            event["pid"] = pid;
+            event["tid"] = buffer->threadIndex;
+            event["args"] = args;
+            events.append(event);
+
+            if (record.flow == NoFlow) {
+                continue;
+            }
+
+            // Flow-событие связывает отправку в одном процессе с приемом в другом
+            QJsonObject flowEvent;
+            flowEvent["name"] = "message";
+            flowEvent["cat"] = "chat.flow";
+            flowEvent["id"] = idToString(record.traceId);
+            flowEvent["ts"] = double(record.startUs);
+            flowEvent["pid"] = pid;
+            flowEvent["tid"] = buffer->threadIndex;
+            if (record.flow == FlowOut) {
+                flowEvent["ph"] = "s";
+            } else {
+                flowEvent["ph"] = "f";
+                flowEvent["bp"] = "e";
+            }
+            events.append(flowEvent);
+        }
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Ошибка записи трассы:" << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
+
+TraceSpan::TraceSpan(const char *name)
+    : m_name(name)
+    , m_active(false)
+    , m_spanId(0)
+    , m_startUs(0)
+    , m_flow(Tracer::NoFlow)
+{
+    begin(Tracer::currentContext(), 0);
+}
+
+TraceSpan::TraceSpan(const char *name, const Tracer::Context &parent, quint64 startUs)
+    : m_name(name)
+    , m_active(false)
+    , m_spanId(0)
+    , m_startUs(0)
+    , m_flow(Tracer::NoFlow)
+{
+    begin(parent, startUs);
+}
+
+// Активирует спан и делает его контекст текущим для потока
+void TraceSpan::begin(const Tracer::Context &parent, quint64 startUs)
+{
+    if (!Tracer::isEnabled() || !parent.isValid()) {
+        return;
+    }
+
+    m_active = true;
+    m_parent = parent;
+    m_spanId = Tracer::newId();
+    m_startUs = startUs ? startUs : Tracer::nowMicros();
+    m_previous = Tracer::currentContext();
+    Tracer::setCurrentContext(context());
+}
+
+// Записывает спан и восстанавливает предыдущий контекст потока
+TraceSpan::~TraceSpan()
+{
+    if (!m_active) {
+        return;
+    }
+
+    Tracer::recordSpan(m_name, m_parent, m_spanId, m_startUs, Tracer::nowMicros(), m_flow);
+    Tracer::setCurrentContext(m_previous);
+}
+
+Tracer::Context TraceSpan::context() const
+{
+    Tracer::Context context;
+    if (m_active) {
+        context.traceId = m_parent.traceId;
+        context.spanId = m_spanId;
+    }
+    return context;
+}
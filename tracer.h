@@ -0,0 +1,93 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <QtGlobal>
+
+/*
+ * Класс для выборочной трассировки пути сообщения
+ * Записывает спаны этапов обработки (сеть, отображение, база данных)
+ * в буферы потоков и выгружает их в формате Chrome trace-event JSON,
+ * который открывается в Perfetto или chrome://tracing
+ */
+class Tracer
+{
+public:
+    // Контекст трассировки: идентификатор трассы и текущего спана
+    struct Context
+    {
+        quint64 traceId = 0;
+        quint64 spanId = 0;
+
+        // Контекст действителен, только если сообщение выбрано для трассировки
+        bool isValid() const { return traceId != 0; }
+    };
+
+    // Связь спана с другим процессом через flow-события
+    enum Flow {
+        NoFlow,
+        FlowOut,
+        FlowIn
+    };
+
+    // Включает или выключает запись спанов
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+    // Задает долю сообщений, выбираемых для трассировки (от 0 до 1)
+    static void setSampleRate(double rate);
+
+    // Начинает новую трассу, если сообщение попало в выборку, иначе возвращает пустой контекст
+    static Context startTrace();
+    // Контекст трассировки, активный в текущем потоке
+    static Context currentContext();
+    static void setCurrentContext(const Context &context);
+
+    // Текущее время в микросекундах от начала эпохи
+    static quint64 nowMicros();
+    // Создает новый ненулевой идентификатор спана или трассы
+    static quint64 newId();
+
+    // Записывает завершенный спан в буфер текущего потока
+    static void recordSpan(const char *name, const Context &parent, quint64 spanId,
+                           quint64 startUs, quint64 endUs, Flow flow = NoFlow);
+    // Записывает завершенный спан с новым идентификатором
+    static void recordSpan(const char *name, const Context &parent, quint64 startUs, quint64 endUs);
+
+    // Сохраняет все накопленные спаны в файл в формате Chrome trace-event JSON
+    static bool writeChromeTrace(const QString &path);
+};
+
+/*
+ * Спан с областью видимости: начинается в конструкторе и записывается в деструкторе
+ * На время жизни делает свой контекст текущим, чтобы вложенные этапы становились дочерними
+ * Если трассировка выключена или сообщение не выбрано, ничего не делает
+ */
+class TraceSpan
+{
+public:
+    // Дочерний спан текущего контекста потока
+    explicit TraceSpan(const char *name);
+    // Спан с явно заданным родителем (например, из контекста в кадре)
+    TraceSpan(const char *name, const Tracer::Context &parent, quint64 startUs = 0);
+    ~TraceSpan();
+
+    // Контекст этого спана для передачи дальше
+    Tracer::Context context() const;
+    // Помечает спан как начало или конец межпроцессной связи
+    void setFlow(Tracer::Flow flow) { m_flow = flow; }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    void begin(const Tracer::Context &parent, quint64 startUs);
+
+    const char *m_name;
+    bool m_active;
+    Tracer::Context m_parent;
+    Tracer::Context m_previous;
+    quint64 m_spanId;
+    quint64 m_startUs;
+    Tracer::Flow m_flow;
+};
+
+#endif // TRACER_H
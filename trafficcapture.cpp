@@ -0,0 +1,118 @@
+#include "trafficcapture.h"
+
+namespace {
+
+// Сигнатура файла записи трафика
+const char CaptureMagic[] = "CHATCAP1";
+const int CaptureMagicSize = 8;
+
+} // namespace
+
+TrafficCapture::TrafficCapture()
+{
+}
+
+TrafficCapture::~TrafficCapture()
+{
+    close();
+}
+
+/**
+ * Создает файл записи трафика
+ *
+ * @param path Путь к файлу; существующий файл перезаписывается
+ * @return true, если файл открыт для записи
+ */
+bool TrafficCapture::open(const QString &path)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+
+    m_stream.setDevice(&m_file);
+    m_stream.setByteOrder(QDataStream::BigEndian);
+    m_stream.writeRawData(CaptureMagic, CaptureMagicSize);
+    m_clock.start();
+    return true;
+}
+
+void TrafficCapture::close()
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    m_stream.setDevice(nullptr);
+    m_file.close();
+}
+
+bool TrafficCapture::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+/**
+ * Добавляет запись в файл
+ * Запись идет через буфер QFile, поэтому на горячем пути нет отдельного системного вызова
+ *
+ * @param kind Вид записи
+ * @param connectionId Идентификатор соединения
+ * @param data Байты кадра (для записей о кадрах)
+ */
+void TrafficCapture::write(RecordKind kind, quint32 connectionId, const QByteArray &data)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    m_stream << quint8(kind) << qint64(m_clock.nsecsElapsed()) << connectionId << data;
+}
+
+/**
+ * Читает файл записи трафика целиком
+ *
+ * @param path Путь к файлу
+ * @param records Прочитанные записи в порядке записи
+ * @param errorMessage Описание ошибки при неудаче
+ * @return true, если файл прочитан без ошибок
+ */
+bool TrafficCapture::readAll(const QString &path, QVector<Record> &records, QString *errorMessage)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage) *errorMessage = file.errorString();
+        return false;
+    }
+
+    if (file.read(CaptureMagicSize) != QByteArray(CaptureMagic, CaptureMagicSize)) {
+        if (errorMessage) *errorMessage = "Файл не является записью трафика";
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::BigEndian);
+
+    records.clear();
+    while (!stream.atEnd()) {
+        quint8 kind = 0;
+        Record record;
+        stream >> kind >> record.timestampNs >> record.connectionId >> record.data;
+
+        // Оборванная последняя запись (процесс завершился во время записи) не мешает воспроизведению
+        if (stream.status() == QDataStream::ReadPastEnd) {
+            break;
+        }
+        if (stream.status() != QDataStream::Ok || kind < ConnectionOpened || kind > OutboundFrame) {
+            if (errorMessage) *errorMessage = "Запись трафика повреждена";
+            return false;
+        }
+
+        record.kind = RecordKind(kind);
+        records.append(record);
+    }
+
+    return true;
+}
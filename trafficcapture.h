@@ -0,0 +1,67 @@
+#ifndef TRAFFICCAPTURE_H
+#define TRAFFICCAPTURE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+/*
+ * Класс для записи сетевого трафика в компактный двоичный файл
+ * Файл начинается с сигнатуры CHATCAP1, за ней идут записи:
+ * [вид quint8][время от начала записи, нс qint64][соединение quint32][данные QByteArray]
+ * Кадры сохраняются целиком в формате WireProtocol, поэтому их можно воспроизвести как есть
+ */
+class TrafficCapture
+{
+public:
+    // Вид записи
+    enum RecordKind : quint8 {
+        ConnectionOpened = 1,
+        ConnectionClosed = 2,
+        // Кадр, принятый от собеседника
+        InboundFrame = 3,
+        // Кадр, отправленный собеседнику
+        OutboundFrame = 4
+    };
+
+    // Одна запись файла
+    struct Record
+    {
+        RecordKind kind = ConnectionOpened;
+        qint64 timestampNs = 0;
+        quint32 connectionId = 0;
+        QByteArray data;
+    };
+
+    // Конструктор класса
+    TrafficCapture();
+    // Деструктор класса: дописывает и закрывает файл
+    ~TrafficCapture();
+
+    // Создает файл записи и запускает отсчет времени
+    bool open(const QString &path);
+    // Закрывает файл записи
+    void close();
+    // Признак идущей записи
+    bool isOpen() const;
+    // Добавляет запись с текущим временем
+    void write(RecordKind kind, quint32 connectionId, const QByteArray &data = QByteArray());
+
+    // Читает все записи из файла
+    static bool readAll(const QString &path, QVector<Record> &records, QString *errorMessage = nullptr);
+
+private:
+    Q_DISABLE_COPY(TrafficCapture)
+
+    // Файл записи
+    QFile m_file;
+    // Поток для сериализации записей
+    QDataStream m_stream;
+    // Часы с наносекундным разрешением, запущенные при открытии файла
+    QElapsedTimer m_clock;
+};
+
+#endif // TRAFFICCAPTURE_H
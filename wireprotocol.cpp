@@ -0,0 +1,134 @@
+#include "wireprotocol.h"
+
+#include <QtEndian>
+
+namespace {
+
+// Размер поля длины кадра
+const int LengthSize = sizeof(quint32);
+// Размер обязательной части заголовка: тип и флаги
+const int HeaderSize = 2;
+// Размер контекста трассировки: идентификатор трассы и спана
+const int TraceContextSize = 2 * sizeof(quint64);
+// Размер идентификатора сообщения: узел-источник, номер и время отправки
+const int MessageIdSize = 2 * sizeof(quint64) + sizeof(qint64);
+
+// Дописывает целое число в буфер в порядке big-endian
+template <typename T>
+void appendBigEndian(QByteArray &data, T value)
+{
+    const T bigEndian = qToBigEndian(value);
+    data.append(reinterpret_cast<const char *>(&bigEndian), sizeof(T));
+}
+
+// Читает целое число в порядке big-endian из указанной позиции
+template <typename T>
+T readBigEndian(const QByteArray &data, int position)
+{
+    return qFromBigEndian<T>(data.constData() + position);
+}
+
+} // namespace
+
+namespace WireProtocol {
+
+/**
+ * Кодирует кадр в байтовое представление
+ *
+ * @param frame Кадр для кодирования
+ * @return Байты кадра вместе с префиксом длины
+ */
+QByteArray encode(const Frame &frame)
+{
+    const bool traced = frame.flags & HasTraceContext;
+    const bool identified = frame.flags & HasMessageId;
+    const quint32 length = HeaderSize + (traced ? TraceContextSize : 0)
+            + (identified ? MessageIdSize : 0) + frame.body.size();
+
+    QByteArray data;
+    data.reserve(LengthSize + int(length));
+    appendBigEndian<quint32>(data, length);
+    data.append(char(frame.type));
+    data.append(char(frame.flags));
+
+    // Контекст трассировки передается только для выбранных сообщений
+    if (traced) {
+        appendBigEndian<quint64>(data, frame.traceId);
+        appendBigEndian<quint64>(data, frame.parentSpanId);
+    }
+
+    // Идентификатор нужен ретрансляторам для подавления повторов
+    if (identified) {
+        appendBigEndian<quint64>(data, frame.originId);
+        appendBigEndian<quint64>(data, frame.sequence);
+        appendBigEndian<qint64>(data, frame.originTimeMs);
+    }
+
+    data.append(frame.body);
+    return data;
+}
+
+/**
+ * Разбирает очередной кадр из буфера
+ * Буфер не изменяется, чтобы вызывающий мог удалить все прочитанные кадры за один раз
+ *
+ * @param buffer Накопленные байты соединения
+ * @param offset Позиция начала кадра, после успешного разбора указывает на следующий кадр
+ * @param frame Разобранный кадр
+ * @return Decoded при успехе, Incomplete если данных пока недостаточно, Malformed при ошибке формата
+ */
+DecodeResult decode(const QByteArray &buffer, int &offset, Frame &frame)
+{
+    const int available = buffer.size() - offset;
+    if (available < LengthSize) {
+        return Incomplete;
+    }
+
+    const quint32 length = readBigEndian<quint32>(buffer, offset);
+    if (length < quint32(HeaderSize) || length > MaxFrameSize) {
+        return Malformed;
+    }
+    if (available - LengthSize < int(length)) {
+        return Incomplete;
+    }
+
+    int position = offset + LengthSize;
+    frame.type = quint8(buffer.at(position));
+    frame.flags = quint8(buffer.at(position + 1));
+    position += HeaderSize;
+
+    int bodySize = int(length) - HeaderSize;
+    if (frame.flags & HasTraceContext) {
+        if (bodySize < TraceContextSize) {
+            return Malformed;
+        }
+        frame.traceId = readBigEndian<quint64>(buffer, position);
+        frame.parentSpanId = readBigEndian<quint64>(buffer, position + sizeof(quint64));
+        position += TraceContextSize;
+        bodySize -= TraceContextSize;
+    } else {
+        frame.traceId = 0;
+        frame.parentSpanId = 0;
+    }
+
+    if (frame.flags & HasMessageId) {
+        if (bodySize < MessageIdSize) {
+            return Malformed;
+        }
+        frame.originId = readBigEndian<quint64>(buffer, position);
+        frame.sequence = readBigEndian<quint64>(buffer, position + sizeof(quint64));
+        frame.originTimeMs = readBigEndian<qint64>(buffer, position + 2 * sizeof(quint64));
+        position += MessageIdSize;
+        bodySize -= MessageIdSize;
+    } else {
+        frame.originId = 0;
+        frame.sequence = 0;
+        frame.originTimeMs = 0;
+    }
+
+    frame.body = buffer.mid(position, bodySize);
+    offset = position + bodySize;
+    return Decoded;
+}
+
+} // namespace WireProtocol
@@ -0,0 +1,84 @@
+#ifndef WIREPROTOCOL_H
+#define WIREPROTOCOL_H
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QtGlobal>
+
+/*
+ * Формат кадров, которыми обмениваются экземпляры чата
+ * Кадр: [длина quint32][тип quint8][флаги quint8][контекст трассировки][идентификатор][тело]
+ * Длина записывается в порядке big-endian и не включает сами 4 байта длины,
+ * контекст трассировки присутствует только при установленном флаге HasTraceContext,
+ * идентификатор сообщения (узел-источник, номер и время отправки) - при флаге HasMessageId
+ */
+namespace WireProtocol {
+
+// Типы кадров
+enum FrameType : quint8 {
+    MessageFrame = 1,
+    // Проверка активности соединения и ответ на нее
+    PingFrame = 2,
+    PongFrame = 3,
+    // Представление узла-ретранслятора: тело содержит его идентификатор
+    HelloFrame = 4,
+    // Сверка истории сообщений: тело разбирает HistorySync
+    SyncFrame = 5
+};
+
+// Флаги заголовка кадра
+enum FrameFlag : quint8 {
+    HasTraceContext = 0x01,
+    HasMessageId = 0x02
+};
+
+// Происхождение сообщения: узел, где оно появилось, номер на этом узле и время отправки
+// Одинаково у всех экземпляров, через которые прошло сообщение, поэтому служит
+// его постоянным идентификатором в истории
+struct MessageOrigin
+{
+    quint64 nodeId = 0;
+    quint64 sequence = 0;
+    // Время отправки, мс от начала эпохи UTC
+    qint64 timeMs = 0;
+
+    bool isValid() const { return nodeId != 0; }
+};
+
+// Максимальный размер кадра, защищает от некорректных данных в потоке
+const quint32 MaxFrameSize = 16 * 1024 * 1024;
+
+// Разобранный кадр
+struct Frame
+{
+    quint8 type = MessageFrame;
+    quint8 flags = 0;
+    // Идентификатор трассы и спана отправителя (при флаге HasTraceContext)
+    quint64 traceId = 0;
+    quint64 parentSpanId = 0;
+    // Идентификатор сообщения: узел, где оно появилось, номер на этом узле
+    // и время отправки в мс UTC (при флаге HasMessageId)
+    quint64 originId = 0;
+    quint64 sequence = 0;
+    qint64 originTimeMs = 0;
+    QByteArray body;
+};
+
+// Результат попытки разобрать кадр из буфера
+enum DecodeResult {
+    Incomplete,
+    Decoded,
+    Malformed
+};
+
+// Кодирует кадр в байты для записи в сокет
+QByteArray encode(const Frame &frame);
+
+// Разбирает кадр, начиная с позиции offset, и сдвигает offset за прочитанный кадр
+DecodeResult decode(const QByteArray &buffer, int &offset, Frame &frame);
+
+} // namespace WireProtocol
+
+Q_DECLARE_METATYPE(WireProtocol::MessageOrigin)
+
+#endif // WIREPROTOCOL_H